@@ -0,0 +1,377 @@
+/*
+ * Runs reference CPC routines over the output of the other tools in a
+ * Z80 interpreter and reports their time in T-states and CPC NOPs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "z80.h"
+#include "crtc.h"
+
+#define CODE_ADDR   0x0100         /* reference routine */
+#define LINES_ADDR  0x0200         /* screen line address table */
+#define TABLE_ADDR  0x0600         /* 256 byte aligned lookup table */
+#define DATA_ADDR   0x4000         /* tool output */
+#define SCREEN_ADDR 0xc000
+
+/* NOPs in a 50Hz frame of 312 lines of 64us */
+#define FRAME_NOPS (312 * 64)
+
+struct routine_s {
+    char *name;
+    int mask_coef;                 /* bytes per pixel byte in the data */
+    u8 code[40];
+    int code_size;
+};
+
+/*
+  Sprite routines, called with HL = sprite, IX = line table, B = height
+  and C = width in bytes, blitting to the start of each line.
+*/
+struct routine_s routines[] = {
+    {
+        "mask", 2, {
+            0xdd, 0x5e, 0x00,      /* row: ld e,(ix+0) */
+            0xdd, 0x56, 0x01,      /*      ld d,(ix+1) */
+            0xdd, 0x23,            /*      inc ix */
+            0xdd, 0x23,            /*      inc ix */
+            0xc5,                  /*      push bc */
+            0x41,                  /*      ld b,c */
+            0x1a,                  /* col: ld a,(de) */
+            0xa6,                  /*      and (hl) */
+            0x23,                  /*      inc hl */
+            0xb6,                  /*      or (hl) */
+            0x23,                  /*      inc hl */
+            0x12,                  /*      ld (de),a */
+            0x13,                  /*      inc de */
+            0x10, 0xf7,            /*      djnz col */
+            0xc1,                  /*      pop bc */
+            0x10, 0xe8,            /*      djnz row */
+            0x76                   /*      halt */
+        }, 25
+    },
+    {
+        "plain", 1, {
+            0xdd, 0x5e, 0x00,      /* row: ld e,(ix+0) */
+            0xdd, 0x56, 0x01,      /*      ld d,(ix+1) */
+            0xdd, 0x23,            /*      inc ix */
+            0xdd, 0x23,            /*      inc ix */
+            0xc5,                  /*      push bc */
+            0x41,                  /*      ld b,c */
+            0x7e,                  /* col: ld a,(hl) */
+            0x12,                  /*      ld (de),a */
+            0x23,                  /*      inc hl */
+            0x13,                  /*      inc de */
+            0x10, 0xfa,            /*      djnz col */
+            0xc1,                  /*      pop bc */
+            0x10, 0xeb,            /*      djnz row */
+            0x76                   /*      halt */
+        }, 22
+    },
+    {
+        /* Transparent ink 0, see --transparent auto */
+        "or", 1, {
+            0xdd, 0x5e, 0x00,      /* row: ld e,(ix+0) */
+            0xdd, 0x56, 0x01,      /*      ld d,(ix+1) */
+            0xdd, 0x23,            /*      inc ix */
+            0xdd, 0x23,            /*      inc ix */
+            0xc5,                  /*      push bc */
+            0x41,                  /*      ld b,c */
+            0x1a,                  /* col: ld a,(de) */
+            0xb6,                  /*      or (hl) */
+            0x12,                  /*      ld (de),a */
+            0x23,                  /*      inc hl */
+            0x13,                  /*      inc de */
+            0x10, 0xf9,            /*      djnz col */
+            0xc1,                  /*      pop bc */
+            0x10, 0xea,            /*      djnz row */
+            0x76                   /*      halt */
+        }, 23
+    },
+    {
+        /* Mask from the pixel byte, see --mask-table. H' = table */
+        "mask-table", 1, {
+            0xd9,                  /* row: exx */
+            0xdd, 0x5e, 0x00,      /*      ld e,(ix+0) */
+            0xdd, 0x56, 0x01,      /*      ld d,(ix+1) */
+            0xd9,                  /*      exx */
+            0xdd, 0x23,            /*      inc ix */
+            0xdd, 0x23,            /*      inc ix */
+            0xc5,                  /*      push bc */
+            0x41,                  /*      ld b,c */
+            0x7e,                  /* col: ld a,(hl) */
+            0x23,                  /*      inc hl */
+            0xd9,                  /*      exx */
+            0x6f,                  /*      ld l,a */
+            0x4f,                  /*      ld c,a */
+            0x1a,                  /*      ld a,(de) */
+            0xa6,                  /*      and (hl) */
+            0xb1,                  /*      or c */
+            0x12,                  /*      ld (de),a */
+            0x13,                  /*      inc de */
+            0xd9,                  /*      exx */
+            0x10, 0xf3,            /*      djnz col */
+            0xc1,                  /*      pop bc */
+            0x10, 0xe2,            /*      djnz row */
+            0x76                   /*      halt */
+        }, 31
+    },
+};
+
+/* Whole data copied to the screen, called with BC = length */
+struct routine_s copy_routine = {
+    "ldir", 1, {
+        0x21, 0x00, 0x40,          /* ld hl,DATA_ADDR */
+        0x11, 0x00, 0xc0,          /* ld de,SCREEN_ADDR */
+        0xed, 0xb0,                /* ldir */
+        0x76                       /* halt */
+    }, 9
+};
+
+struct args_s {
+    char *inputfile;               /* tool output to run the routine on */
+    char *tablefile;               /* lookup table for the routine */
+    char *routine;                 /* routine name */
+    int width;                     /* sprite width in bytes, without mask */
+    int height;                    /* sprite height in lines */
+    int pages;                     /* number of sprites in the data */
+};
+
+u8 *read_file(char *filename, int *size)
+{
+    FILE *file;
+    u8 *buffer;
+
+    file = fopen(filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", filename);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    buffer = malloc(*size + 1);
+
+    if (fread(buffer, 1, *size, file) != (size_t) *size) {
+        fprintf(stderr, "Unable to read file: %s\n", filename);
+        exit(1);
+    }
+
+    fclose(file);
+
+    return buffer;
+}
+
+void parse_args(int argc, char *argv[], struct args_s *args)
+{
+    int i;
+
+    assert(args);
+
+    args->tablefile = NULL;
+    args->routine = "mask";
+    args->width = 0;
+    args->height = 0;
+    args->pages = 1;
+
+    if (argc < 2) {
+        printf("Usage: %s input.bin [--routine mask] [--width 0] [--height 0] [--pages 1] [--table mask1.bin]\n", argv[0]);
+        printf("\n");
+        printf("\t--routine\tmask, plain, or, mask-table for sprites, ldir to copy a screen.\n");
+        printf("\t--width\t\tSprite width in bytes, without mask.\n");
+        printf("\t--height\tSprite height in lines.\n");
+        printf("\t--pages\t\tNumber of sprites (offset pages) in the input.\n");
+        printf("\t--table\t\tLookup table for the mask-table routine.\n");
+        exit(0);
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--routine") == 0 ||
+            strcmp(argv[i], "--width") == 0 ||
+            strcmp(argv[i], "--height") == 0 ||
+            strcmp(argv[i], "--pages") == 0 ||
+            strcmp(argv[i], "--table") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+        }
+
+        if (strcmp(argv[i], "--routine") == 0) {
+            args->routine = argv[i + 1];
+        }
+
+        if (strcmp(argv[i], "--width") == 0) {
+            args->width = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--height") == 0) {
+            args->height = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--pages") == 0) {
+            args->pages = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--table") == 0) {
+            args->tablefile = argv[i + 1];
+        }
+    }
+
+    args->inputfile = argv[1];
+}
+
+void report(char *what, unsigned long tstates, unsigned long nops)
+{
+    printf("%s: %lu T-states, %lu NOPs, %.1f%% of a frame\n",
+           what, tstates, nops, nops * 100.0 / FRAME_NOPS);
+}
+
+int main(int argc, char *argv[])
+{
+    struct args_s args;
+    struct routine_s *routine;
+    struct z80_s z80;
+    struct crtc_s regs = { 63, 40, 25, 7, 0x30, 0 };
+    u16 *lines;
+    int line_counter;
+    u8 *mem;
+    u8 *data;
+    int data_size;
+    unsigned long tstates;
+    unsigned long nops;
+    int errors;
+    int i, k, x, y;
+
+    parse_args(argc, argv, &args);
+
+    data = read_file(args.inputfile, &data_size);
+
+    if (data_size > SCREEN_ADDR - DATA_ADDR) {
+        fprintf(stderr, "Input does not fit in memory: %d bytes\n", data_size);
+        exit(1);
+    }
+
+    mem = malloc(0x10000);
+    memset(mem, 0, 0x10000);
+    memcpy(mem + DATA_ADDR, data, data_size);
+
+    if (strcmp(args.routine, copy_routine.name) == 0) {
+        int length = data_size < 0x4000 ? data_size : 0x4000;
+
+        memcpy(mem + CODE_ADDR, copy_routine.code, copy_routine.code_size);
+
+        z80_reset(&z80, mem);
+        z80.pc = CODE_ADDR;
+        z80.b = length >> 8;
+        z80.c = length & 0xff;
+
+        if (z80_run(&z80, 10 * FRAME_NOPS) != 0) {
+            exit(1);
+        }
+
+        errors = memcmp(mem + SCREEN_ADDR, data, length) != 0;
+
+        report("copy", z80.tstates, z80.nops);
+        printf("per KB: %.0f NOPs\n", z80.nops * 1024.0 / length);
+        printf("check: %s\n", errors ? "failed" : "ok");
+
+        return errors;
+    }
+
+    routine = NULL;
+
+    for (i = 0; i < (int) (sizeof(routines) / sizeof(routines[0])); i++) {
+        if (strcmp(args.routine, routines[i].name) == 0) {
+            routine = &routines[i];
+        }
+    }
+
+    if (routine == NULL) {
+        fprintf(stderr, "Unknown routine: %s\n", args.routine);
+        exit(1);
+    }
+
+    if (args.width <= 0 || args.height <= 0 || args.pages <= 0 ||
+        args.width * args.height * routine->mask_coef * args.pages > data_size) {
+        fprintf(stderr, "Sprite size does not match the input of %d bytes\n", data_size);
+        exit(1);
+    }
+
+    crtc_init(regs, &lines, &line_counter);
+
+    if (args.height > line_counter) {
+        fprintf(stderr, "Sprite is higher than the screen\n");
+        exit(1);
+    }
+
+    for (i = 0; i < args.height; i++) {
+        mem[LINES_ADDR + i * 2 + 0] = lines[i] & 0xff;
+        mem[LINES_ADDR + i * 2 + 1] = lines[i] >> 8;
+    }
+
+    if (args.tablefile) {
+        u8 *table;
+        int table_size;
+
+        table = read_file(args.tablefile, &table_size);
+        memcpy(mem + TABLE_ADDR, table, table_size < 256 ? table_size : 256);
+        free(table);
+    }
+
+    memcpy(mem + CODE_ADDR, routine->code, routine->code_size);
+
+    tstates = 0;
+    nops = 0;
+    errors = 0;
+
+    for (k = 0; k < args.pages; k++) {
+        u8 *sprite = data + k * args.width * args.height * routine->mask_coef;
+
+        memset(mem + SCREEN_ADDR, 0, 0x4000);
+
+        z80_reset(&z80, mem);
+        z80.pc = CODE_ADDR;
+        z80.sp = CODE_ADDR;
+        z80.ix = LINES_ADDR;
+        z80.h = (DATA_ADDR + (sprite - data)) >> 8;
+        z80.l = (DATA_ADDR + (sprite - data)) & 0xff;
+        z80.b = args.height;
+        z80.c = args.width;
+        z80.h2 = TABLE_ADDR >> 8;
+
+        if (z80_run(&z80, 10 * FRAME_NOPS) != 0) {
+            exit(1);
+        }
+
+        tstates += z80.tstates;
+        nops += z80.nops;
+
+        /* Blitting on an empty screen leaves the pixel bytes */
+        for (y = 0; y < args.height; y++) {
+            for (x = 0; x < args.width; x++) {
+                u8 pixel = sprite[(y * args.width + x) * routine->mask_coef
+                                  + routine->mask_coef - 1];
+
+                errors += mem[lines[y] + x] != pixel;
+            }
+        }
+    }
+
+    printf("routine: %s, sprite: %dx%d bytes, pages: %d\n",
+           routine->name, args.width, args.height, args.pages);
+    report("per sprite", tstates / args.pages, nops / args.pages);
+    printf("sprites per frame: %lu\n", FRAME_NOPS / (nops / args.pages));
+    printf("check: %s\n", errors ? "failed" : "ok");
+
+    free(lines);
+    free(mem);
+    free(data);
+
+    return errors != 0;
+}
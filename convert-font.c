@@ -2,6 +2,11 @@
  * Converts a gif file that contains a tile map into a vertical column
  * for the given cell_width and cell_height.
  *
+ * With --mode the glyphs are packed straight into the CPC screen format
+ * of the mode instead, followed by an offset table of the glyphs. With
+ * --proportional each glyph is cut to its ink extents and a width table
+ * is added.
+ *
  * Compile with cc -Wpedantic -std=c89 ../utils/convert-font.c -lgif -oconvert-font
  *
  * The target layout is useful for the CPC renderer.
@@ -14,7 +19,7 @@
 #include <assert.h>
 #include <string.h>
 
-typedef unsigned char u8;
+#include "ga.h"
 
 void parse_u8(char *str, int *n)
 {
@@ -52,6 +57,162 @@ void blit_rect(u8 *src, u8 *dst,
   }
 }
 
+/*
+  Finds the first and last column of the glyph with a pixel that is
+  not the background ink. Returns 0 if the glyph is empty.
+*/
+int find_extents(u8 *src, int width, int x0, int y0,
+                 int cell_width, int cell_height, int background,
+                 int *x1, int *x2)
+{
+  int i, j;
+
+  *x1 = cell_width;
+  *x2 = -1;
+
+  for (j = 0; j < cell_height; j++) {
+    for (i = 0; i < cell_width; i++) {
+      if (src[(y0 + j) * width + x0 + i] != background) {
+        *x1 = i < *x1 ? i : *x1;
+        *x2 = i > *x2 ? i : *x2;
+      }
+    }
+  }
+
+  return *x2 >= 0;
+}
+
+/*
+  Packs each cell_width x cell_height glyph of the tile map into bytes
+  of the mode, glyph by glyph, and writes the offset of every glyph
+  into an assembler table next to the output file.
+
+  Proportional glyphs start at their leftmost ink pixel and take only
+  the bytes up to their rightmost one. Empty glyphs, like the space,
+  take no bytes and are half a cell wide. Their widths in pixels and
+  bytes follow the offsets.
+*/
+void write_glyphs(char *filename, u8 *src, int width,
+                  int col_num, int row_num,
+                  int cell_width, int cell_height, int mode,
+                  int proportional, int background)
+{
+  FILE *file;
+  char tblname[256];
+  char *label;
+  u8 *glyphs;
+  int *offsets;
+  int *pixels;
+  int ppb;
+  int glyph_width;
+  int glyph_size;
+  int size;
+  int x, y, i, j, k;
+
+  ppb = GET_PPB(mode);
+  glyph_width = (cell_width + ppb - 1) / ppb;
+  glyph_size = glyph_width * cell_height;
+
+  /* Proportional glyphs are never larger than the cells */
+  glyphs = malloc(col_num * row_num * glyph_size + 1);
+  offsets = malloc(col_num * row_num * sizeof(int));
+  pixels = malloc(col_num * row_num * sizeof(int));
+  memset(glyphs, 0, col_num * row_num * glyph_size);
+
+  size = 0;
+
+  for (y = 0; y < row_num; y++) {
+    for (x = 0; x < col_num; x++) {
+      int x1 = 0, x2 = cell_width - 1;
+      u8 *glyph = glyphs + size;
+      int bytes;
+
+      k = y * col_num + x;
+
+      if (proportional &&
+          !find_extents(src, width, x * cell_width, y * cell_height,
+                        cell_width, cell_height, background, &x1, &x2)) {
+        x1 = 0;
+        x2 = -1;
+      }
+
+      pixels[k] = x2 < 0 ? cell_width / 2 : x2 - x1 + 1;
+      offsets[k] = size;
+      bytes = x2 < 0 ? 0 : (x2 - x1 + ppb) / ppb;
+
+      for (j = 0; j < cell_height && bytes; j++) {
+        for (i = x1; i <= x2; i++) {
+          int c = src[(y * cell_height + j) * width + x * cell_width + i];
+
+          glyph[j * bytes + (i - x1) / ppb] |= ga_pixel_byte(mode, c, (i - x1) % ppb);
+        }
+      }
+
+      size += bytes * cell_height;
+    }
+  }
+
+  file = fopen(filename, "wb");
+
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file: %s\n", filename);
+    exit(1);
+  }
+
+  fwrite(glyphs, 1, size, file);
+  fclose(file);
+
+  if (proportional) {
+    printf("proportional: %d -> %d bytes\n", col_num * row_num * glyph_size, size);
+  }
+
+  printf("File %s is created.\n", filename);
+
+  sprintf(tblname, "%.*s.tbl",
+          strrchr(filename, '.') ? (int) (strrchr(filename, '.') - filename) : (int) strlen(filename),
+          filename);
+
+  label = strrchr(tblname, '/') ? strrchr(tblname, '/') + 1 : tblname;
+
+  file = fopen(tblname, "wb");
+
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file: %s\n", tblname);
+    exit(1);
+  }
+
+  if (proportional) {
+    fprintf(file, "glyphs_%.*s: ; %d rows each\n",
+            (int) (strrchr(label, '.') - label), label, cell_height);
+  } else {
+    fprintf(file, "glyphs_%.*s: ; %d x %d bytes each\n",
+            (int) (strrchr(label, '.') - label), label, glyph_width, cell_height);
+  }
+
+  for (i = 0; i < col_num * row_num; i++) {
+    fprintf(file, "    dw 0x%.4x\n", offsets[i]);
+  }
+
+  if (proportional) {
+    fprintf(file, "widths_%.*s:\n", (int) (strrchr(label, '.') - label), label);
+
+    for (i = 0; i < col_num * row_num; i++) {
+      int next = i + 1 < col_num * row_num ? offsets[i + 1] : size;
+
+      fprintf(file, "    db %d, %d ; glyph %d: pixels, bytes\n",
+              pixels[i], (next - offsets[i]) / cell_height, i);
+    }
+  }
+
+  fclose(file);
+
+  printf("File %s is created.\n", tblname);
+
+  free(glyphs);
+  free(offsets);
+  free(pixels);
+}
+
 int main(int argc, char *argv[])
 {
   GifFileType *input_gif;
@@ -66,13 +227,55 @@ int main(int argc, char *argv[])
   int target_width;
   int target_height;
   int error_code;
+  int mode;
+  int proportional;
+  int background;
+  int i;
   ColorMapObject *color_map_object;
 
   if (argc < 5) {
-    printf("Usage: %s input.gif output.gif <cell_width> <cell_height>\n", argv[0]);
+    printf("Usage: %s input.gif output.gif|output.bin <cell_width> <cell_height> [--mode 1] [--proportional [0]]\n", argv[0]);
+    printf("\n");
+    printf("\t--mode\tWrite glyphs packed for the mode into the output file instead of a gif.\n");
+    printf("\t--proportional\tCut the packed glyphs to the extents of the inks other than\n"
+           "\t\tthe background ink, and write their widths into the output name with .tbl.\n");
     return 0;
   }
 
+  mode = -1;
+  proportional = 0;
+  background = 0;
+
+  for (i = 5; i < argc; i++) {
+    if (strcmp(argv[i], "--mode") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(1);
+      }
+
+      parse_u8(argv[i + 1], &mode);
+
+      if (GET_PPB(mode) < 0) {
+        fprintf(stderr, "Invalid mode: %d\n", mode);
+        exit(1);
+      }
+    }
+
+    if (strcmp(argv[i], "--proportional") == 0) {
+      proportional = 1;
+
+      /* The background ink is optional */
+      if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+        parse_u8(argv[i + 1], &background);
+      }
+    }
+  }
+
+  if (proportional && mode == -1) {
+    fprintf(stderr, "--proportional needs --mode\n");
+    exit(1);
+  }
+
   input_gif = DGifOpenFileName(argv[1], &error_code);
 
   if (input_gif == NULL) {
@@ -99,6 +302,16 @@ int main(int argc, char *argv[])
   target_width = cell_width;
   target_height = col_num * row_num * cell_width * cell_height;
 
+  if (mode != -1) {
+    write_glyphs(argv[2], input_data, width, col_num, row_num,
+                 cell_width, cell_height, mode,
+                 proportional, background);
+
+    DGifCloseFile(input_gif, &error_code);
+
+    return 0;
+  }
+
   output_gif = EGifOpenFileName(argv[2], 0, &error_code);
 
   if (output_gif == NULL) {
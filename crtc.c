@@ -9,7 +9,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
-#include <errno.h>
 #include <string.h>
 
 #define VIDEO_ADDR(MA, RA) \
@@ -95,19 +94,136 @@ void print_binary(unsigned short val, char *dest, int highlight)
     }
 }
 
+void parse_num(char *str, int *n)
+{
+    int count;
+
+    assert(str);
+    assert(n);
+
+    if (strchr(str, 'x') || strchr(str, '&')) {
+        count = sscanf(strchr(str, '&') ? strchr(str, '&') + 1 : str, "%x", n);
+    } else {
+        count = sscanf(str, "%d", n);
+    }
+
+    if (count != 1) {
+        fprintf(stderr, "%s it not a number\n", str);
+        exit(1);
+    }
+}
+
+/* Returns the register of the given name, R12 or 12 */
+u8 *find_register(struct crtc_s *regs, char *name)
+{
+    int n = -1;
+
+    if (name[0] == 'R' || name[0] == 'r') {
+        name++;
+    }
+
+    parse_num(name, &n);
+
+    return n == 0 ? &regs->R0 :
+        n == 1 ? &regs->R1 :
+        n == 6 ? &regs->R6 :
+        n == 9 ? &regs->R9 :
+        n == 12 ? &regs->R12 :
+        n == 13 ? &regs->R13 : NULL;
+}
+
+/* Moves the address into the 16K bank it is mapped to */
+u16 remap_bank(u16 cur_line_addr, int *banks)
+{
+    int cur_bank_index;
+
+    cur_bank_index = cur_line_addr >> 14;
+
+    return cur_line_addr + (banks[cur_bank_index] - cur_bank_index) * 0x4000;
+}
+
+/*
+  Formats the line addresses as dw lines of R9 + 1 addresses each,
+  without going through printf for every address. dest must have room
+  for 8 characters per address and 8 per line. Returns the length.
+*/
+int format_table(char *dest, u16 *addresses, int count, int R9)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p;
+    int i;
+
+    p = dest;
+
+    for (i = 0; i < count; i++) {
+        u16 address = addresses[i];
+
+        if (i % (R9 + 1) == 0) {
+            if (i != 0) {
+                *p++ = '\n';
+            }
+
+            memcpy(p, "    dw ", 7);
+            p += 7;
+        }
+
+        *p++ = '0';
+        *p++ = 'x';
+        *p++ = hex[(address >> 12) & 0xf];
+        *p++ = hex[(address >> 8) & 0xf];
+        *p++ = hex[(address >> 4) & 0xf];
+        *p++ = hex[address & 0xf];
+
+        if ((i + 1) % (R9 + 1) != 0) {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+    }
+
+    *p++ = '\n';
+
+    return p - dest;
+}
+
+struct sweep_s {
+    u8 *reg;                       /* swept register */
+    int from;                      /* first value */
+    int to;                        /* last value, inclusive */
+};
+
 int main(int argc, char *argv[])
 {
     int i;
     int binary_info;
     struct crtc_s regs = { 0x3f, 0x32, 0x23, 7, 0x0c, 24 };
+    /* Banks conversion map: default */
+    int banks[4] = { 0, 1, 2, 3 };
+    struct sweep_s sweeps[6];
+    int sweep_count;
+    char *binname;
+    char *asmname;
+    FILE *binfile;
+    FILE *asmfile;
+    char *text;
+    u16 *table;
+    int table_index;
 
     binary_info = 0;
+    sweep_count = 0;
+    binname = NULL;
+    asmname = NULL;
 
     if (argc < (1 + 6)) {
         fprintf(stderr, "Usage: %s (R0) (R1) (R6) (R9) (R12) (R13) "
-                "[b0 b1 b2 b3] [--binary-info]\n", argv[0]);
+                "[b0 b1 b2 b3] [--binary-info]\n"
+                "  [--sweep (R) (from) (to)]... [--bin file] [--asm file]\n", argv[0]);
         fprintf(stderr, "  where R is the CRTC register values,\n");
-        fprintf(stderr, "  where b is the 4K memory bank index (Optional).\n");
+        fprintf(stderr, "  where b is the 16K memory bank index (Optional).\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "  --sweep\tGenerate a table for every value of the register, e.g. R13 0 79.\n");
+        fprintf(stderr, "  \t\tSweeps can be repeated for more registers.\n");
+        fprintf(stderr, "  --bin\t\tWrite the tables as little endian words to the file.\n");
+        fprintf(stderr, "  --asm\t\tWrite the tables as an assembler include to the file.\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Example for default CRTC values:\n");
         fprintf(stderr, "  %s 63 40 25 7 48 0\n", argv[0]);
@@ -124,10 +240,50 @@ int main(int argc, char *argv[])
         if (strcmp(argv[i], "--binary-info") == 0) {
             binary_info = 1;
         }
+
+        if (strcmp(argv[i], "--sweep") == 0) {
+            if (i + 3 >= argc || sweep_count == 6) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            sweeps[sweep_count].reg = find_register(&regs, argv[i + 1]);
+
+            if (sweeps[sweep_count].reg == NULL) {
+                fprintf(stderr, "Unknown register: %s\n", argv[i + 1]);
+                exit(1);
+            }
+
+            parse_num(argv[i + 2], &sweeps[sweep_count].from);
+            parse_num(argv[i + 3], &sweeps[sweep_count].to);
+
+            /* Registers are 8 bits, a wider range would never end */
+            if (sweeps[sweep_count].from < 0 || sweeps[sweep_count].from > sweeps[sweep_count].to ||
+                sweeps[sweep_count].to > 255) {
+                fprintf(stderr, "Invalid sweep range: %s %s\n", argv[i + 2], argv[i + 3]);
+                exit(1);
+            }
+
+            sweep_count++;
+        }
+
+        if (strcmp(argv[i], "--bin") == 0 || strcmp(argv[i], "--asm") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (argv[i][2] == 'b') {
+                binname = argv[i + 1];
+            } else {
+                asmname = argv[i + 1];
+            }
+        }
     }
 
     for (i = 1; i < 7; i++) {
         u8 *r;
+        int n;
 
         r = i == 1 ? &regs.R0 :
             i == 2 ? &regs.R1 :
@@ -136,103 +292,139 @@ int main(int argc, char *argv[])
             i == 5 ? &regs.R12 :
             i == 6 ? &regs.R13 : NULL;
 
-        errno = 0;
-        if (strchr(argv[i], 'x') || strchr(argv[i], '&')) {
-            sscanf(argv[i], "%x", r);
-        } else {
-            sscanf(argv[i], "%d", r);
-        }
-        if (errno) {
-            fprintf(stderr, "No digit found at index: %d\n", 1);
-            exit(1);
+        parse_num(argv[i], &n);
+        *r = n;
+    }
+
+    if (argc >= 7 + 4 && strncmp(argv[7], "--", 2) != 0) {
+        for (i = 0; i < 4; i++) {
+            parse_num(argv[i + 7], &banks[i]);
         }
     }
 
-    /* Banks conversion map: default */
-    int banks[4] = { 0, 1, 2, 3 };
+    for (i = 0; i < sweep_count; i++) {
+        *sweeps[i].reg = sweeps[i].from;
+    }
 
-    if (argc == 7 + 4) {
-        for (i = 0; i < 3; i++) {
-            int j = i + 7;
-            errno = 0;
-            if (strchr(argv[j], 'x') || strchr(argv[j], '&')) {
-                sscanf(argv[j], "%x", &banks[i]);
-            } else {
-                sscanf(argv[j], "%d", &banks[i]);
-            }
-            if (errno) {
-                fprintf(stderr, "No digit found at index: %d\n", 1);
-                exit(1);
-            }
-        }
+    binfile = NULL;
+    asmfile = stdout;
+
+    if (binname) {
+        /* Binary output replaces the default listing on stdout */
+        binfile = fopen(binname, "wb");
+        asmfile = NULL;
     }
 
-    printf("; R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
-           regs.R0, regs.R1, regs.R6, regs.R9, regs.R12, regs.R13);
-    printf("; Banks: %d %d %d %d\n", banks[0], banks[1], banks[2], banks[3]);
+    if (asmname) {
+        asmfile = fopen(asmname, "wb");
+    }
 
-    unsigned short *lines;
-    int line_counter;
+    if ((binname && !binfile) || (asmname && !asmfile)) {
+        fprintf(stderr, "Could not open output file\n");
+        exit(1);
+    }
 
-    crtc_init(regs, &lines, &line_counter);
-
-    for (i = 0; i < line_counter; i++) {
-        u16 cur_line_addr = lines[i];
-        int cur_bank_index;
-        int bank_offset;
-        u16 address;
-
-        if (cur_line_addr >= 0 && cur_line_addr < 0x4000) {
-            cur_bank_index = 0;
-        } else if (cur_line_addr >= 0x4000 && cur_line_addr < 0x8000) {
-            cur_bank_index = 1;
-        } else if (cur_line_addr >= 0x8000 && cur_line_addr < 0xc000) {
-            cur_bank_index = 2;
-        } else if (cur_line_addr >= 0xc000 && cur_line_addr <= 0xffff) {
-            cur_bank_index = 3;
-        } else {
-            assert(0);
-        }
+    text = NULL;
+    table = NULL;
+    table_index = 0;
 
-        bank_offset = (banks[cur_bank_index] - cur_bank_index) * 0x4000;
-        address = cur_line_addr + bank_offset;
+    /* One table for every combination of the swept register values */
+    while (1) {
+        unsigned short *lines;
+        int line_counter;
+
+        crtc_init(regs, &lines, &line_counter);
+
+        for (i = 0; i < line_counter; i++) {
+            lines[i] = remap_bank(lines[i], banks);
+        }
 
         if (binary_info) {
-            char buf[16];
+            printf("; R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
+                   regs.R0, regs.R1, regs.R6, regs.R9, regs.R12, regs.R13);
+            printf("; Banks: %d %d %d %d\n", banks[0], banks[1], banks[2], banks[3]);
+
+            for (i = 0; i < line_counter; i++) {
+                char buf[24];
 
-            if (i % (regs.R9 + 1) == 0) {
-                if (i != 0) {
-                    printf("\n");
+                if (i % (regs.R9 + 1) == 0) {
+                    if (i != 0) {
+                        printf("\n");
+                    }
+                }
+
+                print_binary(lines[i], buf, -1);
+
+                printf("0x%.4x (%s)", lines[i], buf);
+
+                if ((i + 1) % (regs.R9 + 1) != 0) {
+                    printf(", ");
                 }
             }
 
-            print_binary(address, buf, -1);
+            putchar('\n');
+        }
 
-            printf("0x%.4x (%s)", address, buf);
+        if (binfile) {
+            table = realloc(table, line_counter * 2);
 
-            if ((i + 1) % (regs.R9 + 1) != 0) {
-                printf(", ");
+            /* Little endian words regardless of the host */
+            for (i = 0; i < line_counter; i++) {
+                ((u8 *) table)[i * 2 + 0] = lines[i] & 0xff;
+                ((u8 *) table)[i * 2 + 1] = lines[i] >> 8;
             }
-        } else {
-            if (i % (regs.R9 + 1) == 0) {
-                if (i != 0) {
-                    printf("\n");
-                }
 
-                printf("    dw ");
+            fwrite(table, 2, line_counter, binfile);
+        }
+
+        if (asmfile && !binary_info) {
+            int len;
+
+            text = realloc(text, line_counter * 8 + (line_counter / (regs.R9 + 1) + 1) * 8);
+
+            fprintf(asmfile, "; R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
+                    regs.R0, regs.R1, regs.R6, regs.R9, regs.R12, regs.R13);
+            fprintf(asmfile, "; Banks: %d %d %d %d\n", banks[0], banks[1], banks[2], banks[3]);
+
+            if (sweep_count) {
+                fprintf(asmfile, "lines_%d:\n", table_index);
             }
 
-            printf("0x%.4x", address);
+            len = format_table(text, lines, line_counter, regs.R9);
+            fwrite(text, 1, len, asmfile);
+        }
 
-            if ((i + 1) % (regs.R9 + 1) != 0) {
-                printf(", ");
+        free(lines);
+
+        table_index++;
+
+        /* Next value of the swept registers, last sweep runs fastest */
+        for (i = sweep_count - 1; i >= 0; i--) {
+            if (*sweeps[i].reg < sweeps[i].to) {
+                *sweeps[i].reg += 1;
+                break;
             }
+
+            *sweeps[i].reg = sweeps[i].from;
+        }
+
+        if (i < 0) {
+            break;
         }
     }
 
-    putchar('\n');
+    if (binfile) {
+        fclose(binfile);
+        fprintf(stderr, "File %s is created.\n", binname);
+    }
+
+    if (asmfile && asmfile != stdout) {
+        fclose(asmfile);
+        fprintf(stderr, "File %s is created.\n", asmname);
+    }
 
-    free(lines);
+    free(table);
+    free(text);
     return 0;
 }
 #endif
@@ -0,0 +1,372 @@
+/*
+ * Writes the outputs of the other tools into a DATA format disk image.
+ *
+ * Each input is given as file[:load[:exec]]. Binary files get an AMSDOS
+ * header with the load and execution addresses, assembler sources and
+ * other text files are stored as ASCII files without a header.
+ *
+ * Files take consecutive blocks in the order they are given, and the
+ * sectors of every track are interleaved so that the next sector of a
+ * file arrives after the one just read is processed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+
+typedef unsigned char u8;
+
+#define TRACKS 40
+#define SECTORS 9                  /* sectors per track */
+#define SECTOR_SIZE 512
+#define FIRST_SECTOR 0xc1          /* sector ids of the DATA format */
+#define TRACK_SIZE (0x100 + SECTORS * SECTOR_SIZE)
+#define BLOCK_SIZE 1024
+#define BLOCKS (TRACKS * SECTORS * SECTOR_SIZE / BLOCK_SIZE)
+#define DIR_BLOCKS 2               /* 64 directory entries */
+#define DIR_ENTRIES (DIR_BLOCKS * BLOCK_SIZE / 32)
+#define RECORD_SIZE 128
+#define EXTENT_BLOCKS 16           /* blocks of a directory entry */
+#define HEADER_SIZE 128            /* AMSDOS header */
+
+/* Physical order of the sector ids on a track */
+static const int interleave[SECTORS] = { 0, 5, 1, 6, 2, 7, 3, 8, 4 };
+
+struct input_s {
+    char filename[256];
+    char name[8];                  /* AMSDOS name, padded with spaces */
+    char ext[3];
+    int load;                      /* load address */
+    int exec;                      /* execution address */
+    int ascii;                     /* 1 if stored without a header */
+    int size;                      /* size on disk, header included */
+    u8 *data;
+};
+
+void parse_num(char *str, int *n)
+{
+    int count;
+
+    assert(str);
+    assert(n);
+
+    if (strchr(str, 'x') || strchr(str, '&')) {
+        count = sscanf(strchr(str, '&') ? strchr(str, '&') + 1 : str, "%x", n);
+    } else {
+        count = sscanf(str, "%d", n);
+    }
+
+    if (count != 1) {
+        fprintf(stderr, "%s it not a number\n", str);
+        exit(1);
+    }
+}
+
+/* 1 if the extension is one of the text outputs */
+int is_text(char *ext)
+{
+    static const char *texts[] = { "pal", "sym", "asm", "txt", "s", NULL };
+    int i;
+
+    for (i = 0; texts[i]; i++) {
+        if (strcmp(ext, texts[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void set_name(struct input_s *input)
+{
+    char *name;
+    char *ext;
+    int len;
+    int i;
+
+    name = strrchr(input->filename, '/') ? strrchr(input->filename, '/') + 1 : input->filename;
+    ext = strrchr(name, '.') ? strrchr(name, '.') + 1 : name + strlen(name);
+    len = ext > name && ext[-1] == '.' ? ext - name - 1 : ext - name;
+
+    if (len < 1 || len > 8 || strlen(ext) > 3) {
+        fprintf(stderr, "File name does not fit AMSDOS 8.3 names: %s\n", name);
+        exit(1);
+    }
+
+    memset(input->name, ' ', sizeof(input->name));
+    memset(input->ext, ' ', sizeof(input->ext));
+
+    for (i = 0; i < len; i++) {
+        input->name[i] = toupper((unsigned char) name[i]);
+    }
+
+    for (i = 0; ext[i]; i++) {
+        input->ext[i] = toupper((unsigned char) ext[i]);
+    }
+
+    input->ascii = is_text(ext);
+}
+
+/* Binary file header, with the checksum of its first 67 bytes */
+void write_header(struct input_s *input, u8 *header, int len)
+{
+    int sum;
+    int i;
+
+    memset(header, 0, HEADER_SIZE);
+
+    memcpy(header + 0x01, input->name, 8);
+    memcpy(header + 0x09, input->ext, 3);
+    header[0x12] = 2;              /* binary */
+    header[0x13] = len & 0xff;
+    header[0x14] = len >> 8;
+    header[0x15] = input->load & 0xff;
+    header[0x16] = input->load >> 8;
+    header[0x17] = 0xff;
+    header[0x18] = len & 0xff;
+    header[0x19] = len >> 8;
+    header[0x1a] = input->exec & 0xff;
+    header[0x1b] = input->exec >> 8;
+    header[0x40] = len & 0xff;
+    header[0x41] = len >> 8;
+    header[0x42] = 0;
+
+    sum = 0;
+
+    for (i = 0; i < 0x43; i++) {
+        sum += header[i];
+    }
+
+    header[0x43] = sum & 0xff;
+    header[0x44] = (sum >> 8) & 0xff;
+}
+
+void read_input(char *arg, struct input_s *input)
+{
+    FILE *file;
+    char *colon;
+    int len;
+
+    memset(input, 0, sizeof(*input));
+
+    sprintf(input->filename, "%.255s", arg);
+
+    input->load = 0x4000;
+    input->exec = 0;
+
+    /* Addresses follow the name, after the last path separator */
+    colon = strchr(strrchr(input->filename, '/') ? strrchr(input->filename, '/') : input->filename, ':');
+
+    if (colon) {
+        char *exec = strchr(colon + 1, ':');
+
+        *colon = 0;
+
+        if (exec) {
+            *exec = 0;
+            parse_num(exec + 1, &input->exec);
+        }
+
+        parse_num(colon + 1, &input->load);
+    }
+
+    set_name(input);
+
+    file = fopen(input->filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", input->filename);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (!input->ascii && len > 0xffff) {
+        fprintf(stderr, "Binary file is larger than 64K: %s\n", input->filename);
+        exit(1);
+    }
+
+    input->size = input->ascii ? len : HEADER_SIZE + len;
+    input->data = malloc(input->size + 1);
+
+    if (!input->ascii) {
+        write_header(input, input->data, len);
+    }
+
+    if (fread(input->data + input->size - len, 1, len, file) != (size_t) len) {
+        fprintf(stderr, "Unable to read file: %s\n", input->filename);
+        exit(1);
+    }
+
+    fclose(file);
+
+    /* ASCII files end at the first ^Z of their last record */
+    if (input->ascii && input->size % RECORD_SIZE) {
+        input->data[input->size++] = 0x1a;
+    }
+}
+
+/* Address in the image of the logical sector, counted from track 0 */
+u8 *sector_data(u8 *tracks, int sector)
+{
+    int track = sector / SECTORS;
+    int index = sector % SECTORS;
+    int position;
+
+    for (position = 0; interleave[position] != index; position++)
+        ;
+
+    return tracks + track * TRACK_SIZE + 0x100 + position * SECTOR_SIZE;
+}
+
+/* Copies the bytes into the block, which spans two sectors */
+void write_block(u8 *tracks, int block, u8 *data, int len)
+{
+    int sector = block * (BLOCK_SIZE / SECTOR_SIZE);
+    int i;
+
+    for (i = 0; i < BLOCK_SIZE / SECTOR_SIZE && len > 0; i++) {
+        int n = len < SECTOR_SIZE ? len : SECTOR_SIZE;
+
+        memcpy(sector_data(tracks, sector + i), data + i * SECTOR_SIZE, n);
+        len -= n;
+    }
+}
+
+void init_tracks(u8 *tracks)
+{
+    int t, s;
+
+    memset(tracks, 0xe5, TRACKS * TRACK_SIZE);
+
+    for (t = 0; t < TRACKS; t++) {
+        u8 *info = tracks + t * TRACK_SIZE;
+
+        memset(info, 0, 0x100);
+        memcpy(info, "Track-Info\r\n", 12);
+        info[0x10] = t;
+        info[0x11] = 0;
+        info[0x14] = 2;            /* 512 byte sectors */
+        info[0x15] = SECTORS;
+        info[0x16] = 0x4e;         /* gap 3 */
+        info[0x17] = 0xe5;         /* filler */
+
+        for (s = 0; s < SECTORS; s++) {
+            u8 *id = info + 0x18 + s * 8;
+
+            id[0] = t;
+            id[1] = 0;
+            id[2] = FIRST_SECTOR + interleave[s];
+            id[3] = 2;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct input_s input;
+    u8 header[0x100];
+    u8 *tracks;
+    u8 directory[DIR_BLOCKS * BLOCK_SIZE];
+    int entry;
+    int block;
+    FILE *file;
+    int i;
+
+    if (argc < 3) {
+        printf("Usage: %s output.dsk input[:load[:exec]]...\n", argv[0]);
+        printf("\n");
+        printf("\tBinary inputs get an AMSDOS header, loaded at 0x4000 unless given.\n");
+        printf("\tInputs with .pal, .sym, .asm, .txt or .s extensions are ASCII files.\n");
+        exit(0);
+    }
+
+    tracks = malloc(TRACKS * TRACK_SIZE);
+    init_tracks(tracks);
+
+    memset(directory, 0xe5, sizeof(directory));
+
+    entry = 0;
+    block = DIR_BLOCKS;
+
+    for (i = 2; i < argc; i++) {
+        int offset;
+        int extent;
+
+        read_input(argv[i], &input);
+
+        if (block + (input.size + BLOCK_SIZE - 1) / BLOCK_SIZE > BLOCKS) {
+            fprintf(stderr, "No space left for %s (%d bytes)\n", input.filename, input.size);
+            exit(1);
+        }
+
+        /* One directory entry for every 16K of the file */
+        for (offset = 0, extent = 0; offset < input.size || extent == 0; extent++) {
+            u8 *dir = directory + entry * 32;
+            int len = input.size - offset;
+            int k;
+
+            if (entry == DIR_ENTRIES) {
+                fprintf(stderr, "Directory is full at %s\n", input.filename);
+                exit(1);
+            }
+
+            len = len < EXTENT_BLOCKS * BLOCK_SIZE ? len : EXTENT_BLOCKS * BLOCK_SIZE;
+
+            memset(dir, 0, 32);
+            memcpy(dir + 1, input.name, 8);
+            memcpy(dir + 9, input.ext, 3);
+            dir[12] = extent;
+            dir[15] = (len + RECORD_SIZE - 1) / RECORD_SIZE;
+
+            for (k = 0; k * BLOCK_SIZE < len; k++) {
+                int n = len - k * BLOCK_SIZE;
+
+                dir[16 + k] = block;
+                write_block(tracks, block, input.data + offset + k * BLOCK_SIZE,
+                            n < BLOCK_SIZE ? n : BLOCK_SIZE);
+                block++;
+            }
+
+            offset += len;
+            entry++;
+        }
+
+        printf("%.8s.%.3s: %d bytes%s\n", input.name, input.ext, input.size,
+               input.ascii ? ", ASCII" : "");
+
+        free(input.data);
+    }
+
+    for (i = 0; i < DIR_BLOCKS; i++) {
+        write_block(tracks, i, directory + i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, "MV - CPCEMU Disk-File\r\nDisk-Info\r\n", 34);
+    memcpy(header + 0x22, "cpc-bitmap", 10);
+    header[0x30] = TRACKS;
+    header[0x31] = 1;
+    header[0x32] = TRACK_SIZE & 0xff;
+    header[0x33] = TRACK_SIZE >> 8;
+
+    file = fopen(argv[1], "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not create file: %s\n", argv[1]);
+        exit(1);
+    }
+
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(tracks, 1, TRACKS * TRACK_SIZE, file);
+    fclose(file);
+
+    printf("File %s is created (%dK free).\n", argv[1], (BLOCKS - block) * BLOCK_SIZE / 1024);
+
+    free(tracks);
+
+    return 0;
+}
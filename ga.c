@@ -127,6 +127,48 @@ unsigned int ga_convert_col_to_rgb(int col)
     return rgb;
 }
 
+u8 ga_pixel_byte(int mode, int c, int offset)
+{
+    return mode == 2 ? MODE_2_PF(c, offset) :
+           mode == 1 ? MODE_1_PF(c, offset) :
+           mode == 0 ? MODE_0_PF(c, offset) : 0;
+}
+
+u8 ga_pixel_mask(int mode, int offset)
+{
+    return mode == 2 ? MODE_2_MASK(offset) :
+           mode == 1 ? MODE_1_MASK(offset) :
+           mode == 0 ? MODE_0_MASK(offset) : 0;
+}
+
+int ga_pixel_ink(int mode, u8 byte, int offset)
+{
+    return mode == 2 ? MODE_2_INK(byte, offset) :
+           mode == 1 ? MODE_1_INK(byte, offset) :
+           mode == 0 ? MODE_0_INK(byte, offset) : -1;
+}
+
+/* 8 bit intensity rounded to the 16 levels of the ASIC */
+#define PLUS_LEVEL(v) (((v) * 15 + 127) / 255)
+
+u16 ga_plus_color(u8 r, u8 g, u8 b)
+{
+    return PLUS_LEVEL(g) << 8 | PLUS_LEVEL(r) << 4 | PLUS_LEVEL(b);
+}
+
+unsigned int ga_convert_plus_color_to_rgb(u16 color)
+{
+    unsigned int rgb;
+
+    rgb = 0;
+
+    rgb |= ((color >> 4) & 15) * 17 << 16;
+    rgb |= ((color >> 8) & 15) * 17 <<  8;
+    rgb |= ((color >> 0) & 15) * 17 <<  0;
+
+    return rgb;
+}
+
 #ifdef TEST
 int main(int argc, char *argv[])
 {
@@ -78,8 +78,20 @@ typedef unsigned short u16;
     (offset == 0 ? MODE_0_INK_P0(byte) :        \
      offset == 1 ? MODE_0_INK_P1(byte) : -1)
 
+/* Mode appropriate pixel helpers for run time selected modes */
+u8 ga_pixel_byte(int mode, int c, int offset);
+u8 ga_pixel_mask(int mode, int offset);
+int ga_pixel_ink(int mode, u8 byte, int offset);
+
 u8 ga_find_gate_array_color_code(u8 r, u8 g, u8 b);
 u8 ga_find_gate_array_firmware_color_code(u8 r, u8 g, u8 b);
 unsigned int ga_convert_col_to_rgb(int col);
 
+/*
+  CPC Plus ASIC palette entry: 4 bits for each of red and blue in the
+  low byte, green in the high byte, as stored in the ASIC page.
+*/
+u16 ga_plus_color(u8 r, u8 g, u8 b);
+unsigned int ga_convert_plus_color_to_rgb(u16 color);
+
 #endif
@@ -0,0 +1,564 @@
+/**
+   GIF reader for indexed images with a global colour map.
+
+   The LZW data is decoded with fixed size tables straight into the
+   caller's frame buffer. Files using local colour maps are read with
+   libgif instead.
+
+   The file name - reads the gif from the standard input.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "gif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define LZW_CODES 4096
+
+/* Returned by the decoder for files that are read with libgif */
+#define GIF_FALLBACK -2
+
+/* Standard input copied once, as the file is read more than once */
+static FILE *stdin_copy;
+
+static FILE *open_input(char *filename)
+{
+    char block[4096];
+    size_t len;
+
+    if (strcmp(filename, "-") != 0) {
+        return fopen(filename, "rb");
+    }
+
+    if (stdin_copy == NULL) {
+        stdin_copy = tmpfile();
+
+        if (stdin_copy == NULL) {
+            return NULL;
+        }
+
+        while ((len = fread(block, 1, sizeof(block), stdin)) > 0) {
+            fwrite(block, 1, len, stdin_copy);
+        }
+    }
+
+    rewind(stdin_copy);
+
+    return stdin_copy;
+}
+
+static void close_input(FILE *file)
+{
+    if (file != stdin_copy) {
+        fclose(file);
+    }
+}
+
+struct lzw_s {
+    FILE *file;
+    u8 block[256];                 /* current data sub-block */
+    int block_len;
+    int block_pos;
+    unsigned long bits;            /* bits read but not used yet */
+    int bit_count;
+    int end;                       /* 1 after the last sub-block */
+    int truncated;                 /* 1 if the file ends within the data */
+};
+
+struct frame_s {
+    int x;
+    int y;
+    int width;
+    int height;
+    int interlaced;
+    int disposal;                  /* disposal method of the graphic control */
+    int transparent;               /* transparent ink, -1 if none */
+};
+
+/* Returns the little endian word, or -1 at the end of the file */
+static int read_word(FILE *file)
+{
+    int lo = getc(file);
+    int hi = getc(file);
+
+    if (lo == EOF || hi == EOF) {
+        return -1;
+    }
+
+    return lo | hi << 8;
+}
+
+static void skip_blocks(FILE *file)
+{
+    int len;
+
+    while ((len = getc(file)) > 0) {
+        fseek(file, len, SEEK_CUR);
+    }
+}
+
+/* Returns the next code of the given size, or -1 at the end of data */
+static int read_code(struct lzw_s *lzw, int size)
+{
+    int code;
+
+    while (lzw->bit_count < size) {
+        if (lzw->block_pos == lzw->block_len) {
+            lzw->block_len = lzw->end ? 0 : getc(lzw->file);
+
+            if (lzw->block_len <= 0 ||
+                fread(lzw->block, 1, lzw->block_len, lzw->file) != (size_t) lzw->block_len) {
+                lzw->truncated = lzw->block_len != 0;
+                lzw->end = 1;
+                lzw->block_len = 0;
+                return -1;
+            }
+
+            lzw->block_pos = 0;
+        }
+
+        lzw->bits |= (unsigned long) lzw->block[lzw->block_pos++] << lzw->bit_count;
+        lzw->bit_count += 8;
+    }
+
+    code = lzw->bits & ((1 << size) - 1);
+    lzw->bits >>= size;
+    lzw->bit_count -= size;
+
+    return code;
+}
+
+/*
+  Decodes the image data of a frame into dest, which is width pixels
+  wide. Transparent pixels are skipped unless transparent is -1.
+*/
+static int decode_frame(FILE *file, struct frame_s *frame, u8 *dest, int width, int height, int transparent)
+{
+    static const int pass_start[] = { 0, 4, 2, 1 };
+    static const int pass_step[] = { 8, 8, 4, 2 };
+    u16 prefix[LZW_CODES];
+    u8 suffix[LZW_CODES];
+    u8 stack[LZW_CODES + 1];
+    struct lzw_s lzw;
+    int min_size, size;
+    int clear, next;
+    int old, first;
+    int x, y, pass;
+    int code;
+    int i;
+
+    min_size = getc(file);
+
+    if (min_size < 1 || min_size > 11) {
+        return -1;
+    }
+
+    memset(&lzw, 0, sizeof(lzw));
+    lzw.file = file;
+
+    clear = 1 << min_size;
+
+    for (i = 0; i < clear; i++) {
+        suffix[i] = i;
+    }
+
+    size = min_size + 1;
+    next = clear + 2;
+    old = -1;
+    first = 0;
+    x = y = pass = 0;
+
+    while (y < frame->height && (code = read_code(&lzw, size)) >= 0) {
+        int in = code;
+        int sp = 0;
+
+        if (code == clear) {
+            size = min_size + 1;
+            next = clear + 2;
+            old = -1;
+            continue;
+        }
+
+        if (code == clear + 1) {
+            break;
+        }
+
+        if (old == -1) {
+            if (code >= clear) {
+                return -1;
+            }
+
+            stack[sp++] = code;
+            first = code;
+        } else {
+            if (code > next) {
+                return -1;
+            }
+
+            /* The code being defined starts with its own first pixel */
+            if (code == next) {
+                stack[sp++] = first;
+                code = old;
+            }
+
+            while (code >= clear) {
+                stack[sp++] = suffix[code];
+                code = prefix[code];
+            }
+
+            first = code;
+            stack[sp++] = first;
+
+            if (next < LZW_CODES) {
+                prefix[next] = old;
+                suffix[next] = first;
+                next++;
+
+                if (next == 1 << size && size < 12) {
+                    size++;
+                }
+            }
+        }
+
+        old = in;
+
+        /* The pixels are on the stack in reverse order */
+        while (sp > 0 && y < frame->height) {
+            int c = stack[--sp];
+            int dx = frame->x + x;
+            int dy = frame->y + y;
+
+            if (c != transparent && dx < width && dy < height) {
+                dest[dy * width + dx] = c;
+            }
+
+            if (++x == frame->width) {
+                x = 0;
+
+                if (!frame->interlaced) {
+                    y++;
+                } else {
+                    y += pass_step[pass];
+
+                    while (y >= frame->height && pass < 3) {
+                        pass++;
+                        y = pass_start[pass];
+                    }
+
+                    if (y >= frame->height) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (lzw.truncated) {
+        return -1;
+    }
+
+    if (!lzw.end) {
+        skip_blocks(file);
+    }
+
+    return 0;
+}
+
+/* Fills the rectangle of the frame with the ink */
+static void fill_frame(u8 *dest, struct frame_s *frame, int width, int height, int ink)
+{
+    int y, x;
+
+    for (y = frame->y; y < frame->y + frame->height && y < height; y++) {
+        for (x = frame->x; x < frame->x + frame->width && x < width; x++) {
+            dest[y * width + x] = ink;
+        }
+    }
+}
+
+/*
+  Starts frame k as the previous frame after its disposal, or as the
+  background for the first frame. If frame k is disposed to the previous
+  state, that state is kept in the slot of frame k + 1, which starts
+  from it, when the caller decodes that many frames.
+*/
+static void start_frame(u8 *data, int k, struct gif_info_s *info, struct frame_s *previous,
+                        struct frame_s *frame, int frames)
+{
+    int size = info->width * info->height;
+    u8 *dest = data + k * size;
+
+    if (k == 0) {
+        memset(dest, info->background, size);
+    } else if (previous->disposal != DISPOSE_PREVIOUS) {
+        memcpy(dest, dest - size, size);
+
+        if (previous->disposal == DISPOSE_BACKGROUND) {
+            fill_frame(dest, previous, info->width, info->height,
+                       previous->transparent >= 0 ? previous->transparent : info->background);
+        }
+    }
+
+    if (frame->disposal == DISPOSE_PREVIOUS && k + 1 < frames) {
+        memcpy(dest + size, dest, size);
+    }
+}
+
+/*
+  Reads the file with the built-in decoder. Without data only the info
+  is read. Returns the number of frames decoded, -1 on error, or
+  GIF_FALLBACK if the file needs libgif.
+*/
+static int read_gif(FILE *file, struct gif_info_s *info, u8 *data, int frames)
+{
+    struct frame_s frame;
+    struct frame_s previous;
+    u8 header[13];
+    u8 colormap[256 * 3];
+    int decoded;
+    int i;
+
+    memset(info, 0, sizeof(*info));
+    memset(&frame, 0, sizeof(frame));
+    memset(&previous, 0, sizeof(previous));
+    info->transparent = -1;
+    frame.transparent = -1;
+    decoded = 0;
+
+    if (fread(header, 1, 13, file) != 13 ||
+        (memcmp(header, "GIF87a", 6) != 0 && memcmp(header, "GIF89a", 6) != 0) ||
+        !(header[10] & 0x80)) {
+        return GIF_FALLBACK;
+    }
+
+    info->width = header[6] | header[7] << 8;
+    info->height = header[8] | header[9] << 8;
+    info->color_count = 2 << (header[10] & 7);
+    info->background = header[11];
+
+    if (fread(colormap, 3, info->color_count, file) != (size_t) info->color_count) {
+        return -1;
+    }
+
+    for (i = 0; i < info->color_count; i++) {
+        info->colormap[i].Red = colormap[i * 3 + 0];
+        info->colormap[i].Green = colormap[i * 3 + 1];
+        info->colormap[i].Blue = colormap[i * 3 + 2];
+    }
+
+    while (1) {
+        int block = getc(file);
+
+        if (block == 0x21) {
+            int label = getc(file);
+
+            if (label == GRAPHICS_EXT_FUNC_CODE && getc(file) == 4) {
+                int packed = getc(file);
+                int delay = read_word(file);
+
+                frame.transparent = getc(file);
+
+                if (packed == EOF || delay < 0 || frame.transparent == EOF) {
+                    return -1;
+                }
+
+                frame.transparent = packed & 1 ? frame.transparent : -1;
+                frame.disposal = (packed >> 2) & 7;
+
+                if (info->frame_count == 0) {
+                    info->transparent = frame.transparent;
+                }
+            }
+
+            skip_blocks(file);
+        } else if (block == 0x2c) {
+            int packed;
+
+            frame.x = read_word(file);
+            frame.y = read_word(file);
+            frame.width = read_word(file);
+            frame.height = read_word(file);
+
+            packed = getc(file);
+
+            if (frame.x < 0 || frame.y < 0 || frame.width < 0 || frame.height < 0 || packed == EOF) {
+                return -1;
+            }
+
+            frame.interlaced = (packed & 0x40) != 0;
+
+            if (packed & 0x80) {
+                return GIF_FALLBACK;
+            }
+
+            if (data && decoded < frames) {
+                start_frame(data, decoded, info, &previous, &frame, frames);
+
+                if (decode_frame(file, &frame,
+                                 data + decoded * info->width * info->height,
+                                 info->width, info->height,
+                                 decoded ? frame.transparent : -1) < 0) {
+                    return -1;
+                }
+
+                decoded++;
+            } else {
+                getc(file);
+                skip_blocks(file);
+            }
+
+            info->frame_count++;
+            previous = frame;
+            frame.transparent = -1;
+            frame.disposal = 0;
+        } else if (block == 0x3b) {
+            break;
+        } else {
+            return info->frame_count ? decoded : -1;
+        }
+    }
+
+    return decoded;
+}
+
+/* Same as read_gif with libgif */
+static int read_libgif(char *filename, struct gif_info_s *info, u8 *data, int frames)
+{
+    GifFileType *gif_file_type;
+    ColorMapObject *map;
+    GraphicsControlBlock gcb;
+    struct frame_s previous;
+    int error_code;
+    int decoded;
+
+    if (strcmp(filename, "-") == 0) {
+        /* libgif closes the handle it is given. rewind() may only move
+           within the stdio buffer, so the descriptor is seeked too. */
+        open_input(filename);
+        lseek(fileno(stdin_copy), 0, SEEK_SET);
+        gif_file_type = DGifOpenFileHandle(dup(fileno(stdin_copy)), &error_code);
+    } else {
+        gif_file_type = DGifOpenFileName(filename, &error_code);
+    }
+
+    if (gif_file_type == NULL) {
+        return -1;
+    }
+
+    if (DGifSlurp(gif_file_type) == GIF_ERROR || gif_file_type->ImageCount < 1) {
+        DGifCloseFile(gif_file_type, &error_code);
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    memset(&previous, 0, sizeof(previous));
+
+    map = gif_file_type->SColorMap ? gif_file_type->SColorMap :
+        gif_file_type->SavedImages[0].ImageDesc.ColorMap;
+
+    info->width = gif_file_type->SWidth;
+    info->height = gif_file_type->SHeight;
+    info->color_count = map ? map->ColorCount : 0;
+    info->background = gif_file_type->SBackGroundColor;
+    info->frame_count = gif_file_type->ImageCount;
+
+    if (map) {
+        memcpy(info->colormap, map->Colors, info->color_count * sizeof(GifColorType));
+    }
+
+    info->transparent = -1;
+
+    for (decoded = 0; data && decoded < frames && decoded < info->frame_count; decoded++) {
+        SavedImage *image = &gif_file_type->SavedImages[decoded];
+        struct frame_s frame;
+        int y, x;
+
+        frame.x = image->ImageDesc.Left;
+        frame.y = image->ImageDesc.Top;
+        frame.width = image->ImageDesc.Width;
+        frame.height = image->ImageDesc.Height;
+        frame.disposal = 0;
+        frame.transparent = -1;
+
+        if (DGifSavedExtensionToGCB(gif_file_type, decoded, &gcb) == GIF_OK) {
+            frame.disposal = gcb.DisposalMode;
+            frame.transparent = gcb.TransparentColor;
+        }
+
+        start_frame(data, decoded, info, &previous, &frame, frames);
+
+        for (y = 0; y < frame.height && frame.y + y < info->height; y++) {
+            u8 *dest = data + (decoded * info->height + frame.y + y) * info->width;
+
+            for (x = 0; x < frame.width && frame.x + x < info->width; x++) {
+                int c = image->RasterBits[y * frame.width + x];
+
+                if (decoded == 0 || c != frame.transparent) {
+                    dest[frame.x + x] = c;
+                }
+            }
+        }
+
+        previous = frame;
+    }
+
+    if (DGifSavedExtensionToGCB(gif_file_type, 0, &gcb) == GIF_OK) {
+        info->transparent = gcb.TransparentColor;
+    }
+
+    DGifCloseFile(gif_file_type, &error_code);
+
+    return data ? decoded : 0;
+}
+
+int gif_read_info(char *filename, struct gif_info_s *info)
+{
+    return gif_read_frames(filename, info, NULL, 0) < 0 ? -1 : 0;
+}
+
+int gif_read_frames(char *filename, struct gif_info_s *info, u8 *data, int frames)
+{
+    FILE *file;
+    int decoded;
+
+    assert(filename);
+    assert(info);
+
+    file = open_input(filename);
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    decoded = read_gif(file, info, data, frames);
+
+    close_input(file);
+
+    if (decoded == GIF_FALLBACK) {
+        decoded = read_libgif(filename, info, data, frames);
+    }
+
+    return decoded;
+}
+
+u8 *gif_read(char *filename, struct gif_info_s *info)
+{
+    u8 *data;
+
+    if (gif_read_info(filename, info) < 0 || info->frame_count < 1) {
+        return NULL;
+    }
+
+    data = malloc(info->width * info->height + 1);
+
+    if (gif_read_frames(filename, info, data, 1) != 1) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
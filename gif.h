@@ -0,0 +1,41 @@
+#ifndef __GIF_H_
+#define __GIF_H_
+
+#include <gif_lib.h>
+
+#include "ga.h"
+
+struct gif_info_s {
+    int width;                     /* logical screen width */
+    int height;                    /* logical screen height */
+    int color_count;
+    GifColorType colormap[256];    /* global colour map */
+    int background;                /* background ink */
+    int transparent;               /* transparent ink of the first frame, -1 if none */
+    int frame_count;
+};
+
+/*
+  Reads the screen size, colour map and number of frames of the file,
+  or of the standard input if the file name is -.
+  Returns 0, or -1 if the file cannot be read.
+*/
+int gif_read_info(char *filename, struct gif_info_s *info);
+
+/*
+  Decodes the first frames of the file into data, width * height bytes
+  for each frame. Every frame is drawn over the previous one, as it is
+  displayed. Returns the number of frames decoded, or -1 on error.
+
+  Files with a global colour map only are decoded without any memory
+  allocation; other files are read with libgif.
+*/
+int gif_read_frames(char *filename, struct gif_info_s *info, u8 *data, int frames);
+
+/*
+  Reads the info and the first frame into a new buffer, or returns NULL
+  if the file cannot be read.
+*/
+u8 *gif_read(char *filename, struct gif_info_s *info);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Packs the outputs of the other tools into 16K memory banks.
+ *
+ * Each input is given as file.bin:row_bytes. Inputs are placed largest
+ * first at the lowest address of the first bank they fit in, keeping
+ * every row within a 256 byte page where possible, so that the blitter
+ * can step through a row with an 8 bit increment.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef unsigned char u8;
+
+#define BANK_SIZE 0x4000
+#define MAX_BANKS 32               /* 512K of expansion memory */
+
+struct input_s {
+    char filename[256];
+    char label[256];               /* file name without path and extension */
+    int row;                       /* bytes per row */
+    int size;
+    u8 *data;
+    int bank;                      /* placement, -1 if not placed */
+    int addr;                      /* offset in the bank */
+    int crosses;                   /* 1 if rows cross 256 byte pages */
+};
+
+struct args_s {
+    char *output;                  /* output name without extension */
+    int base;                      /* address the banks are mapped to */
+    int banks;                     /* number of banks available */
+};
+
+void parse_num(char *str, int *n)
+{
+    int count;
+
+    assert(str);
+    assert(n);
+
+    if (strchr(str, 'x') || strchr(str, '&')) {
+        count = sscanf(strchr(str, '&') ? strchr(str, '&') + 1 : str, "%x", n);
+    } else {
+        count = sscanf(str, "%d", n);
+    }
+
+    if (count != 1) {
+        fprintf(stderr, "%s it not a number\n", str);
+        exit(1);
+    }
+}
+
+void read_input(char *arg, struct input_s *input)
+{
+    FILE *file;
+    char *colon;
+    char *label;
+
+    memset(input, 0, sizeof(*input));
+
+    sprintf(input->filename, "%.255s", arg);
+
+    colon = strrchr(input->filename, ':');
+    input->row = 0;
+
+    if (colon) {
+        *colon = 0;
+        parse_num(colon + 1, &input->row);
+    }
+
+    file = fopen(input->filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", input->filename);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    input->size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    input->data = malloc(input->size + 1);
+
+    if (fread(input->data, 1, input->size, file) != (size_t) input->size) {
+        fprintf(stderr, "Unable to read file: %s\n", input->filename);
+        exit(1);
+    }
+
+    fclose(file);
+
+    if (input->row <= 0 || input->row > input->size) {
+        input->row = input->size;
+    }
+
+    label = strrchr(input->filename, '/') ? strrchr(input->filename, '/') + 1 : input->filename;
+    sprintf(input->label, "%s", label);
+
+    if (strchr(input->label, '.')) {
+        *strchr(input->label, '.') = 0;
+    }
+
+    input->bank = -1;
+}
+
+/*
+  1 if every row of the input at addr stays within a 256 byte page,
+  with the bank mapped at base.
+*/
+int rows_in_page(int base, int addr, struct input_s *input)
+{
+    int offset;
+
+    if (input->row > 256) {
+        return 0;
+    }
+
+    for (offset = 0; offset < input->size; offset += input->row) {
+        int len = input->size - offset < input->row ? input->size - offset : input->row;
+
+        if ((base + addr + offset) % 256 + len > 256) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Returns the lowest free address of the bank for the input, or -1 */
+int find_space(u8 *used, int base, struct input_s *input, int aligned)
+{
+    int addr;
+    int i;
+
+    for (addr = 0; addr + input->size <= BANK_SIZE; addr++) {
+        if (aligned && !rows_in_page(base, addr, input)) {
+            continue;
+        }
+
+        for (i = 0; i < input->size; i++) {
+            if (used[addr + i]) {
+                break;
+            }
+        }
+
+        if (i == input->size) {
+            return addr;
+        }
+
+        /* No start before the used byte can fit */
+        addr += i;
+    }
+
+    return -1;
+}
+
+int compare_size(const void *a, const void *b)
+{
+    const struct input_s *ia = *(const struct input_s **) a;
+    const struct input_s *ib = *(const struct input_s **) b;
+
+    return ib->size - ia->size;
+}
+
+int main(int argc, char *argv[])
+{
+    struct args_s args;
+    struct input_s *inputs;
+    struct input_s **order;
+    int input_count;
+    u8 *banks;
+    u8 *used;
+    int *bank_end;
+    char filename[300];
+    FILE *file;
+    int i, k;
+
+    if (argc < 3) {
+        printf("Usage: %s output input.bin[:row_bytes]... [--base 0x4000] [--banks 4]\n", argv[0]);
+        printf("\n");
+        printf("\t--base\t\tAddress the banks are mapped to.\n");
+        printf("\t--banks\t\tNumber of 16K banks to fill, up to %d.\n", MAX_BANKS);
+        exit(0);
+    }
+
+    args.output = argv[1];
+    args.base = 0x4000;
+    args.banks = 4;
+
+    inputs = malloc(argc * sizeof(struct input_s));
+    order = malloc(argc * sizeof(struct input_s *));
+    input_count = 0;
+
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--base") == 0 || strcmp(argv[i], "--banks") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            parse_num(argv[i + 1], strcmp(argv[i], "--base") == 0 ? &args.base : &args.banks);
+            i++;
+            continue;
+        }
+
+        read_input(argv[i], &inputs[input_count]);
+        order[input_count] = &inputs[input_count];
+        input_count++;
+    }
+
+    if (args.banks < 1 || args.banks > MAX_BANKS) {
+        fprintf(stderr, "Invalid number of banks: %d\n", args.banks);
+        exit(1);
+    }
+
+    banks = malloc(args.banks * BANK_SIZE);
+    used = malloc(args.banks * BANK_SIZE);
+    bank_end = malloc(args.banks * sizeof(int));
+    memset(banks, 0, args.banks * BANK_SIZE);
+    memset(used, 0, args.banks * BANK_SIZE);
+    memset(bank_end, 0, args.banks * sizeof(int));
+
+    qsort(order, input_count, sizeof(struct input_s *), compare_size);
+
+    for (i = 0; i < input_count; i++) {
+        struct input_s *input = order[i];
+        int aligned;
+
+        /* First try with rows kept in pages, then anywhere */
+        for (aligned = 1; aligned >= 0 && input->bank < 0; aligned--) {
+            for (k = 0; k < args.banks; k++) {
+                int addr = find_space(used + k * BANK_SIZE, args.base, input, aligned);
+
+                if (addr >= 0) {
+                    input->bank = k;
+                    input->addr = addr;
+                    input->crosses = !aligned && !rows_in_page(args.base, addr, input);
+                    break;
+                }
+            }
+        }
+
+        if (input->bank < 0) {
+            fprintf(stderr, "No space left for %s (%d bytes)\n", input->filename, input->size);
+            exit(1);
+        }
+
+        memcpy(banks + input->bank * BANK_SIZE + input->addr, input->data, input->size);
+        memset(used + input->bank * BANK_SIZE + input->addr, 1, input->size);
+
+        if (input->addr + input->size > bank_end[input->bank]) {
+            bank_end[input->bank] = input->addr + input->size;
+        }
+
+        if (input->crosses) {
+            printf("%s: rows cross 256 byte pages\n", input->filename);
+        }
+    }
+
+    for (k = 0; k < args.banks; k++) {
+        if (bank_end[k] == 0) {
+            continue;
+        }
+
+        sprintf(filename, "%s%d.bin", args.output, k);
+
+        file = fopen(filename, "wb");
+        fwrite(banks + k * BANK_SIZE, 1, bank_end[k], file);
+        fclose(file);
+
+        printf("File %s is created (%d bytes free).\n", filename, BANK_SIZE - bank_end[k]);
+    }
+
+    sprintf(filename, "%s.sym", args.output);
+
+    file = fopen(filename, "wb");
+
+    for (i = 0; i < input_count; i++) {
+        fprintf(file, "%s equ 0x%.4x ; bank %d, %d bytes%s\n",
+                inputs[i].label, args.base + inputs[i].addr, inputs[i].bank,
+                inputs[i].size, inputs[i].crosses ? ", rows cross pages" : "");
+        fprintf(file, "%s_bank equ %d\n", inputs[i].label, inputs[i].bank);
+    }
+
+    fclose(file);
+
+    printf("File %s is created.\n", filename);
+
+    for (i = 0; i < input_count; i++) {
+        free(inputs[i].data);
+    }
+
+    free(inputs);
+    free(order);
+    free(banks);
+    free(used);
+    free(bank_end);
+
+    return 0;
+}
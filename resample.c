@@ -0,0 +1,130 @@
+/**
+   Resamples indexed images to the pixel aspect of a screen mode.
+
+   Only integer arithmetic is used and ties are broken by position, so
+   the same input always gives the same output.
+ */
+#include "resample.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+struct resample_job_s {
+    u8 *data;
+    u8 *output;
+    int width;
+    int new_width;
+    int filter;
+    int y1;                        /* first row of the job */
+    int y2;                        /* last row of the job, exclusive */
+};
+
+int resample_width(int mode, int width)
+{
+    int new_width = width * GET_PPB(mode) / 4;
+
+    /* A single pixel wide image stays a pixel wide in mode 0 */
+    return new_width > 0 ? new_width : 1;
+}
+
+/* Resamples a single row */
+void resample_row(u8 *src, u8 *dest, int width, int new_width, int filter)
+{
+    int count[256];
+    int x, i;
+
+    for (x = 0; x < new_width; x++) {
+        /* Source pixels covered by the destination pixel */
+        int x1 = x * width / new_width;
+        int x2 = (x + 1) * width / new_width;
+        int best;
+
+        if (filter == RESAMPLE_NEAREST || x2 - x1 <= 1) {
+            dest[x] = src[(2 * x + 1) * width / (2 * new_width)];
+            continue;
+        }
+
+        for (i = x1; i < x2; i++) {
+            count[src[i]] = 0;
+        }
+
+        best = src[x1];
+
+        /* The leftmost ink wins a tie */
+        for (i = x1; i < x2; i++) {
+            count[src[i]]++;
+
+            if (count[src[i]] > count[best]) {
+                best = src[i];
+            }
+        }
+
+        dest[x] = best;
+    }
+}
+
+void *resample_job(void *arg)
+{
+    struct resample_job_s *job = arg;
+    int y;
+
+    for (y = job->y1; y < job->y2; y++) {
+        resample_row(&job->data[y * job->width],
+                     &job->output[y * job->new_width],
+                     job->width, job->new_width, job->filter);
+    }
+
+    return NULL;
+}
+
+u8 *resample(u8 *data, int width, int height, int new_width, int filter, int jobs)
+{
+    struct resample_job_s *job;
+    pthread_t *threads;
+    u8 *output;
+    int i;
+
+    assert(data);
+    assert(new_width > 0);
+
+    output = malloc(new_width * height + 1);
+
+    jobs = jobs > height ? height : jobs;
+    jobs = jobs < 1 ? 1 : jobs;
+
+    job = malloc(jobs * sizeof(*job));
+    threads = malloc(jobs * sizeof(*threads));
+
+    for (i = 0; i < jobs; i++) {
+        job[i].data = data;
+        job[i].output = output;
+        job[i].width = width;
+        job[i].new_width = new_width;
+        job[i].filter = filter;
+        job[i].y1 = height * i / jobs;
+        job[i].y2 = height * (i + 1) / jobs;
+    }
+
+    if (jobs == 1) {
+        resample_job(&job[0]);
+    } else {
+        for (i = 0; i < jobs; i++) {
+            if (pthread_create(&threads[i], NULL, resample_job, &job[i]) != 0) {
+                fprintf(stderr, "Could not create thread\n");
+                exit(1);
+            }
+        }
+
+        for (i = 0; i < jobs; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    free(threads);
+    free(job);
+
+    return output;
+}
@@ -0,0 +1,24 @@
+#ifndef __RESAMPLE_H_
+#define __RESAMPLE_H_
+
+#include "ga.h"
+
+/* Filters of resample */
+#define RESAMPLE_NEAREST 0         /* pixel under the centre */
+#define RESAMPLE_BOX 1             /* most used ink of the covered pixels */
+
+/*
+  Width of square pixel art, drawn at the mode 1 pixel aspect, in the
+  pixels of the given mode: half for mode 0, double for mode 2. It is
+  at least 1.
+*/
+int resample_width(int mode, int width);
+
+/*
+  Returns a new_width wide copy of the indexed image, resampled
+  horizontally with the filter. Rows are split among the given number
+  of threads; the result does not depend on it.
+*/
+u8 *resample(u8 *data, int width, int height, int new_width, int filter, int jobs);
+
+#endif
@@ -1,213 +1,640 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <gif_lib.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 
 #include "ga.h"
+#include "gif.h"
+#include "resample.h"
 
 #include "crtc.h"
 
 struct crtc_s regs = { 63, 40, 25, 7, 0x0c, 00 };
 
+#define SNA_HEADER_SIZE 0x100
+#define SNA_MEMORY_SIZE 0x10000
+#define FRAME_LINES 312            /* raster lines of a 50 Hz frame */
+
+struct run_s {
+    int addr;                      /* first byte of the run */
+    int len;
+};
+
+struct region_s {
+    int rows;                      /* image rows in the region */
+    int mode;
+    struct crtc_s regs;
+    u16 *lines;                    /* address of each raster line of the region */
+    int line_counter;
+    int shown;                     /* raster lines displayed from the region */
+};
+
+struct layer_s {
+    char *inputfile;               /* layer .gif file */
+    int x;                         /* position in pixels of the mode */
+    int y;
+    int ink;                       /* transparent ink of the layer, -1 if none */
+    struct gif_info_s info;
+    u8 *data;
+    int inks[256];                 /* screen ink of each layer ink, color_count if none */
+};
+
+struct screen_s {
+    char *inputfile;               /* input .gif file */
+    char basename[256];            /* input file full path without extension */
+    char *basename_begin;          /* input file without path and extension */
+    char filename[256];            /* output .bin file */
+    char filename1[256];           /* output first half with -2 */
+    char filename2[256];           /* output second half with -2 */
+    char palname[256];             /* output .pal for palette data */
+    char pabname[256];             /* binary file containing palette ink numbers */
+    char mapname[256];             /* output .map of the runs with --strip-gaps */
+    char snaname[256];             /* output .sna snapshot with --sna */
+    int two_files;                 /* 1 if output is split in two files */
+    int split;                     /* address the second file starts at */
+    int strip;                     /* 1 if only the displayed bytes are written */
+    int sna;                       /* 1 if a snapshot is written too */
+    int repeat;                    /* raster lines of each image row, R9 + 1 */
+    struct run_s *runs;            /* displayed byte runs, split at split */
+    int run_count;
+    int mode;
+    int ppb;
+    int resample;                  /* resample filter, -1 if not resampled */
+    int jobs;                      /* number of threads to resample with */
+    int source_width;              /* width of the gif before resampling */
+    struct region_s *regions;      /* vertical regions, top to bottom */
+    int region_count;
+    u8 *row_region;                /* region of each image row */
+    u16 *lines;                    /* address of each image row */
+    struct layer_s *layers;        /* images drawn over the screen in order */
+    int layer_count;
+    int width;
+    int height;
+    int total_address_space;
+    u8 *buffer;                    /* packed screen memory */
+    u8 palette[16][2];             /* 0: hardware number, 1: firmware number */
+    FILE *output;                  /* .bin stream with --stdout, else NULL */
+    int palette_fd;                /* .pal file descriptor, -1 for a file */
+};
+
 void parse_num(char *str, unsigned char *n)
 {
+    int value;
+
     errno = 0;
 
     assert(str);
     assert(n);
 
+    value = 0;
+
     if (strchr(str, 'x') || strchr(str, '&')) {
-        sscanf(str, "%x", n);
+        sscanf(str, "%x", &value);
     } else {
-        sscanf(str, "%d", n);
+        sscanf(str, "%d", &value);
     }
 
     if (errno) {
         fprintf(stderr, "%s it not a number", str);
         exit(1);
     }
+
+    *n = value;
 }
 
-int main(int argc, char *argv[])
+/* Returns the first frame of the gif file, or NULL if it cannot be read */
+u8 *gif_load(char *inputfile, struct gif_info_s *info)
 {
-    FILE *file;
-    GifFileType *gif_file_type;
-    GifColorType *colormap;
-    int width;
-    int height;
-    int y, x;
-    int i, j;
-    u8 *buffer;
-    int basename_len;
-    char basename[256];
-    char *basename_begin;
-    char filename[256];
-    char filename1[15];
-    char filename2[15];
-    char palname[256];
-    char pabname[256]; /* This is a binary file containing palette ink numbers */
-    u16 *lines;
     u8 *data;
-    int line_counter;
-    int error_code;
-    int color_count;
-    int mode;
-    int ppb;
-    int two_files;
-    int total_address_space;
-    u8 palette[16][2]; /* 0: hardware number, 1: firmware number */
 
-    two_files = 0;
+    data = gif_read(inputfile, info);
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s input.gif [--mode 1] [--crtc (R0) (R1) (R6) (R9) (R12) (R13)] [-2]\n", argv[0]);
+    if (data == NULL) {
+        fprintf(stderr, "Unable to read gif file: %s\n", inputfile);
+    }
+
+    return data;
+}
+
+/*
+  Returns the image at the pixel aspect of the mode, which is to be
+  freed if it is not data.
+*/
+u8 *screen_data(struct screen_s *screen, u8 *data)
+{
+    if (screen->resample < 0) {
+        return data;
+    }
+
+    return resample(data, screen->source_width, screen->height,
+                    screen->width, screen->resample, screen->jobs);
+}
+
+/*
+  Builds the line table of every region and gives each image row the
+  address of its raster line in its region. Without regions, the whole
+  image is a single region with the --mode and --crtc settings.
+*/
+void init_regions(struct screen_s *screen)
+{
+    int explicit;
+    int y, r;
+
+    explicit = screen->region_count > 0;
+
+    if (!explicit) {
+        screen->regions = malloc(sizeof(struct region_s));
+        screen->regions[0].rows = screen->height;
+        screen->regions[0].mode = screen->mode;
+        screen->regions[0].regs = regs;
+        screen->region_count = 1;
+    }
+
+    screen->lines = malloc(screen->height * sizeof(u16));
+    screen->row_region = malloc(screen->height);
+    screen->total_address_space = 0;
+
+    y = 0;
+
+    for (r = 0; r < screen->region_count; r++) {
+        struct region_s *region = &screen->regions[r];
+        int i;
+
+        crtc_init(region->regs, &region->lines, &region->line_counter);
+
+        /* A region shows its rows, a single region the whole frame */
+        region->shown = explicit && region->rows < region->line_counter ?
+            region->rows : region->line_counter;
+
+        for (i = 0; i < region->rows && y < screen->height; i++, y++) {
+            int end;
+
+            if (i * screen->repeat >= region->line_counter) {
+                fprintf(stderr, "Region %d has only %d raster lines\n", r, region->line_counter);
+                exit(1);
+            }
+
+            /* Repeated rows are stored once, on the first raster line */
+            screen->lines[y] = region->lines[i * screen->repeat];
+            screen->row_region[y] = r;
+
+            /* The first raster lines wrap within 2K with a short R9 */
+            if (screen->repeat > 1 && i > 0 && screen->lines[y] <= screen->lines[y - 1]) {
+                fprintf(stderr, "Row %d wraps onto row 0 of the 2K block, too many rows for --line-repeat\n", y);
+                exit(1);
+            }
+
+            end = screen->lines[y] + region->regs.R1 * 2;
+
+            if (end > screen->total_address_space) {
+                screen->total_address_space = end;
+            }
+        }
+    }
+
+    if (y < screen->height) {
+        fprintf(stderr, "Regions cover %d of %d rows\n", y, screen->height);
         exit(1);
     }
+}
+
+void free_regions(struct screen_s *screen)
+{
+    int r;
+
+    for (r = 0; r < screen->region_count; r++) {
+        free(screen->regions[r].lines);
+    }
+
+    free(screen->regions);
+    free(screen->row_region);
+    free(screen->lines);
+}
 
-    mode = 1;
+/* Bytes the image row takes, no more than the CRTC displays */
+int row_bytes(struct screen_s *screen, int y)
+{
+    struct region_s *region = &screen->regions[screen->row_region[y]];
+    int ppb = GET_PPB(region->mode);
+    int len = (screen->width + ppb - 1) / ppb;
 
-    for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-2") == 0) {
-            two_files = 1;
+    return len < region->regs.R1 * 2 ? len : region->regs.R1 * 2;
+}
+
+/* Packs the rows y1 to y2 (exclusive) of the image into the screen */
+void pack_rows(struct screen_s *screen, u8 *data, int y1, int y2)
+{
+    int y, x;
+
+    for (y = y1; y < y2; y++) {
+        u8 *line = &screen->buffer[screen->lines[y]];
+        int mode = screen->regions[screen->row_region[y]].mode;
+        int ppb = GET_PPB(mode);
+        int len = row_bytes(screen, y);
+
+        memset(line, 0, len);
+
+        for (x = 0; x < len * ppb && x < screen->width; x++) {
+            const int c = data[y * screen->width + x];
+            const int offset = x % ppb;
+            u8 *pixel_addr = &line[x / ppb];
+
+            if (mode == 2) {
+                *pixel_addr |= MODE_2_PF(c, offset);
+            } else if (mode == 1) {
+                *pixel_addr |= MODE_1_PF(c, offset);
+            } else if (mode == 0) {
+                *pixel_addr |= MODE_0_PF(c, offset);
+            }
         }
+    }
+}
 
-        if (strcmp(argv[i], "--mode") == 0) {
-            u8 n;
+/*
+  Loads the layers and maps their colours to the inks of the screen
+  with the same colour.
+*/
+void load_layers(struct screen_s *screen, GifColorType *colormap, int color_count)
+{
+    int i, c, k;
 
-            if (i + 1 >= argc) {
-                fprintf(stderr, "Invalid arguments\n");
-                exit(1);
+    for (i = 0; i < screen->layer_count; i++) {
+        struct layer_s *layer = &screen->layers[i];
+        GifColorType *map;
+
+        layer->data = gif_load(layer->inputfile, &layer->info);
+
+        if (layer->data == NULL) {
+            exit(1);
+        }
+
+        if (layer->ink == -1) {
+            layer->ink = layer->info.transparent;
+        }
+
+        map = layer->info.colormap;
+
+        for (c = 0; c < layer->info.color_count; c++) {
+            GifColorType color = map[c];
+
+            for (k = 0; k < color_count; k++) {
+                if (colormap[k].Red == color.Red &&
+                    colormap[k].Green == color.Green &&
+                    colormap[k].Blue == color.Blue) {
+                    break;
+                }
             }
 
-            parse_num(argv[i + 1], &n);
-            mode = n;
+            layer->inks[c] = k;
         }
 
-        if (strcmp(argv[i], "--crtc") == 0) {
-            if (i + 6 >= argc) {
-                fprintf(stderr, "Invalid arguments\n");
+        /* Unused colours of the layer need not be in the palette */
+        for (k = 0; k < layer->info.width * layer->info.height; k++) {
+            c = layer->data[k];
+
+            if (layer->inks[c] == color_count && c != layer->ink) {
+                fprintf(stderr, "Colour %.2x %.2x %.2x of %s is not in the palette\n",
+                        map[c].Red, map[c].Green, map[c].Blue, layer->inputfile);
                 exit(1);
             }
+        }
 
-            parse_num(argv[i + 1], &regs.R0);
-            parse_num(argv[i + 2], &regs.R1);
-            parse_num(argv[i + 3], &regs.R6);
-            parse_num(argv[i + 4], &regs.R9);
-            parse_num(argv[i + 5], &regs.R12);
-            parse_num(argv[i + 6], &regs.R13);
+        printf("Layer %s at %d, %d", layer->inputfile, layer->x, layer->y);
+
+        if (layer->ink >= 0) {
+            printf(", transparent ink %d", layer->ink);
         }
+
+        printf("\n");
+    }
+}
+
+void free_layers(struct screen_s *screen)
+{
+    int i;
+
+    for (i = 0; i < screen->layer_count; i++) {
+        free(screen->layers[i].data);
     }
 
-    ppb = GET_PPB(mode);
+    free(screen->layers);
+}
+
+/*
+  Draws the layers over the packed rows y1 to y2 (exclusive). Only the
+  bits of the opaque pixels are replaced, so bytes shared with the
+  pixels around a layer keep them.
+*/
+void compose_rows(struct screen_s *screen, int y1, int y2)
+{
+    int i, y, x;
 
-    printf("R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
-           regs.R0, regs.R1, regs.R6, regs.R9, regs.R12, regs.R13);
+    for (i = 0; i < screen->layer_count; i++) {
+        struct layer_s *layer = &screen->layers[i];
+        int width = layer->info.width;
+        int height = layer->info.height;
+        u8 *data = layer->data;
 
-    printf("Mode %d\n", mode);
+        for (y = y1 > layer->y ? y1 : layer->y; y < y2 && y < layer->y + height; y++) {
+            u8 *line = &screen->buffer[screen->lines[y]];
+            int mode = screen->regions[screen->row_region[y]].mode;
+            int ppb = GET_PPB(mode);
+            int len = row_bytes(screen, y) * ppb;
 
-    if (!strstr(argv[1], ".gif")) {
-        fprintf(stderr, "File should have .gif extension.\n");
-        exit(1);
+            for (x = layer->x > 0 ? layer->x : 0; x < len && x < layer->x + width; x++) {
+                int c = data[(y - layer->y) * width + x - layer->x];
+                int offset = x % ppb;
+
+                if (c == layer->ink) {
+                    continue;
+                }
+
+                line[x / ppb] = (line[x / ppb] & ~ga_pixel_mask(mode, offset)) |
+                    ga_pixel_byte(mode, layer->inks[c], offset);
+            }
+        }
+    }
+}
+
+/*
+  The second file of -2 starts at the first 16K bank boundary inside the
+  screen, or in the middle if the screen is within a single bank.
+*/
+int find_split(struct screen_s *screen)
+{
+    int start;
+    int i;
+    int split;
+
+    start = screen->total_address_space;
+
+    for (i = 0; i < screen->height; i++) {
+        start = screen->lines[i] < start ? screen->lines[i] : start;
     }
 
-    basename_len = strstr(argv[1], ".gif") - argv[1];
+    split = (start / 0x4000 + 1) * 0x4000;
+
+    return split < screen->total_address_space ? split : screen->total_address_space / 2;
+}
+
+int compare_runs(const void *a, const void *b)
+{
+    return ((const struct run_s *) a)->addr - ((const struct run_s *) b)->addr;
+}
 
-    sprintf(basename, "%.*s", basename_len, argv[1]);
+/*
+  Collects the bytes the CRTC displays as runs of consecutive addresses,
+  leaving out the unused bytes at the end of each 2K line block.
+*/
+void find_runs(struct screen_s *screen)
+{
+    struct run_s *runs;
+    int count;
+    int i, r;
 
-    basename_begin = basename;
+    count = 0;
 
-    if (strrchr(basename, '/')) {
-        basename_begin = strrchr(basename, '/') + 1;
+    for (r = 0; r < screen->region_count; r++) {
+        count += screen->regions[r].shown;
     }
 
-    sprintf(palname, "%s.pal", basename_begin);
-    sprintf(pabname, "%s.pab", basename_begin);
+    runs = malloc((count + 1) * sizeof(struct run_s));
+    count = 0;
 
-    if (strlen(basename_begin) > 8) {
-        fprintf(stderr, "File base name cannot be longer than 8 characters: %s.\n", basename);
-        exit(1);
+    for (r = 0; r < screen->region_count; r++) {
+        struct region_s *region = &screen->regions[r];
+
+        for (i = 0; i < region->shown; i++) {
+            int addr = region->lines[i];
+            int end = addr + region->regs.R1 * 2;
+
+            end = end < screen->total_address_space ? end : screen->total_address_space;
+
+            if (addr < end) {
+                runs[count].addr = addr;
+                runs[count].len = end - addr;
+                count++;
+            }
+        }
     }
 
-    if (two_files) {
-        sprintf(filename1, "%s1.bin", basename_begin);
-        sprintf(filename2, "%s2.bin", basename_begin);
-    } else {
-        sprintf(filename, "%s.bin", basename_begin);
+    qsort(runs, count, sizeof(struct run_s), compare_runs);
+
+    screen->run_count = 0;
+
+    for (i = 0; i < count; i++) {
+        struct run_s *last = screen->run_count ? &runs[screen->run_count - 1] : NULL;
+
+        if (last && runs[i].addr <= last->addr + last->len &&
+            !(screen->two_files && runs[i].addr >= screen->split && last->addr < screen->split)) {
+            int end = runs[i].addr + runs[i].len;
+
+            if (end > last->addr + last->len) {
+                last->len = end - last->addr;
+            }
+        } else {
+            runs[screen->run_count++] = runs[i];
+        }
     }
 
-    gif_file_type = DGifOpenFileName(argv[1], &error_code);
+    /* A run can still cross the split at its end */
+    for (i = 0; screen->two_files && i < screen->run_count; i++) {
+        struct run_s *run = &runs[i];
 
-    if (gif_file_type == NULL) {
-        fprintf(stderr, "Could not open file: %s\n", argv[1]);
-        exit(1);
+        if (run->addr < screen->split && run->addr + run->len > screen->split) {
+            memmove(run + 2, run + 1, (screen->run_count - i - 1) * sizeof(struct run_s));
+            run[1].addr = screen->split;
+            run[1].len = run->addr + run->len - screen->split;
+            run->len = screen->split - run->addr;
+            screen->run_count++;
+            break;
+        }
     }
 
-    if (DGifSlurp(gif_file_type) == GIF_ERROR) {
-        fprintf(stderr, "Unable to read gif file: %s\n", argv[1]);
+    screen->runs = runs;
+}
+
+/*
+  Keeps a stream of the standard output for the binary output and sends
+  everything printed to the standard error instead.
+*/
+static FILE *stdout_output(void)
+{
+    FILE *output;
+
+    fflush(stdout);
+
+    output = fdopen(dup(1), "wb");
+
+    if (output == NULL || dup2(2, 1) < 0) {
+        fprintf(stderr, "Could not redirect the standard output\n");
         exit(1);
     }
 
-    color_count = gif_file_type->SColorMap->ColorCount;
-    colormap = gif_file_type->SColorMap[0].Colors;
-
-    width = gif_file_type->SWidth;
-    height = gif_file_type->SHeight;
+    return output;
+}
 
-    data = gif_file_type->SavedImages[0].RasterBits;
+/* Opens the output file, or returns the standard output with --stdout */
+FILE *open_output(struct screen_s *screen, char *filename)
+{
+    FILE *file;
 
-    crtc_init(regs, &lines, &line_counter);
+    if (screen->output) {
+        return screen->output;
+    }
 
-    printf("width: %d, height: %d, color_count: %d\n", width, height, color_count);
+    file = fopen(filename, "wb");
 
-    if (height - 1 < 0) {
-        fprintf(stderr, "Invalid data\n");
+    if (file == NULL) {
+        fprintf(stderr, "Could not create file: %s\n", filename);
         exit(1);
     }
 
-    printf("%.4x\n", lines[height - 1]);
+    return file;
+}
+
+void close_output(struct screen_s *screen, FILE *file, char *filename)
+{
+    if (file == screen->output) {
+        fflush(file);
+        return;
+    }
+
+    fclose(file);
+    printf("File %s is created.\n", filename);
+}
 
-    total_address_space = lines[height - 1] + (regs.R1 * 2);
-    buffer = malloc(total_address_space);
-    memset(buffer, 0, total_address_space);
+/* Writes the runs from start (inclusive) to end (exclusive) into the file */
+int write_runs(struct screen_s *screen, char *filename, int start, int end)
+{
+    FILE *file;
+    int i;
+    int size;
 
-    printf("total_address_space: %d (0x%.4x)\n", total_address_space, total_address_space);
+    file = open_output(screen, filename);
+    size = 0;
 
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            const int c = data[y * width + x];
-            const int offset = x % ppb;
-            u8 *pixel_addr = &buffer[lines[y] + (x / ppb)];
+    for (i = 0; i < screen->run_count; i++) {
+        struct run_s *run = &screen->runs[i];
 
-            if (mode == 2) {
-                *pixel_addr |= MODE_2_PF(c, offset);
-            } else if (mode == 1) {
-                *pixel_addr |= MODE_1_PF(c, offset);
-            } else if (mode == 0) {
-                *pixel_addr |= MODE_0_PF(c, offset);
-            }
+        if (run->addr >= start && run->addr < end) {
+            fwrite(screen->buffer + run->addr, sizeof(u8), run->len, file);
+            size += run->len;
         }
     }
 
-    if (two_files) {
-        file = fopen(filename1, "wb");
-        fwrite(buffer, sizeof(u8), total_address_space / 2, file);
+    close_output(screen, file, filename);
+
+    return size;
+}
+
+/* Loader map: address and length words of each run, ending with 0, 0 */
+void write_map(struct screen_s *screen)
+{
+    FILE *file;
+    int i;
+
+    file = fopen(screen->mapname, "wb");
+
+    for (i = 0; i <= screen->run_count; i++) {
+        int addr = i < screen->run_count ? screen->runs[i].addr : 0;
+        int len = i < screen->run_count ? screen->runs[i].len : 0;
+        u8 run[4];
+
+        run[0] = addr & 0xff;
+        run[1] = addr >> 8;
+        run[2] = len & 0xff;
+        run[3] = len >> 8;
+
+        fwrite(run, 1, 4, file);
+    }
+
+    fclose(file);
+    printf("File %s is created (%d runs).\n", screen->mapname, screen->run_count);
+}
+
+void write_screen(struct screen_s *screen)
+{
+    FILE *file;
+    int total_address_space;
+
+    total_address_space = screen->total_address_space;
+
+    if (screen->strip) {
+        int size;
+
+        if (screen->two_files) {
+            size = write_runs(screen, screen->filename1, 0, screen->split);
+            size += write_runs(screen, screen->filename2, screen->split, total_address_space);
+        } else {
+            size = write_runs(screen, screen->filename, 0, total_address_space);
+        }
+
+        printf("stripped: %d -> %d bytes\n", total_address_space, size);
+
+        write_map(screen);
+    } else if (screen->two_files) {
+        file = fopen(screen->filename1, "wb");
+        fwrite(screen->buffer, sizeof(u8), screen->split, file);
         fclose(file);
-        printf("File %s is created.\n", filename1);
+        printf("File %s is created.\n", screen->filename1);
 
-        file = fopen(filename2, "wb");
-        fwrite(buffer + total_address_space / 2, sizeof(u8), total_address_space / 2, file);
+        file = fopen(screen->filename2, "wb");
+        fwrite(screen->buffer + screen->split, sizeof(u8), total_address_space - screen->split, file);
         fclose(file);
-        printf("File %s is created.\n", filename2);
+        printf("File %s is created.\n", screen->filename2);
     } else {
-        file = fopen(filename, "wb");
-        fwrite(buffer, sizeof(u8), total_address_space, file);
-        fclose(file);
-        printf("File %s is created.\n", filename);
+        file = open_output(screen, screen->filename);
+        fwrite(screen->buffer, sizeof(u8), total_address_space, file);
+        close_output(screen, file, screen->filename);
+    }
+}
+
+/* Rewrites the given byte range of the screen in the output files */
+void update_screen(struct screen_s *screen, int start, int end)
+{
+    FILE *file;
+    int half;
+
+    half = screen->split;
+
+    if (screen->two_files && start < half && end > half) {
+        update_screen(screen, start, half);
+        update_screen(screen, half, end);
+        return;
+    }
+
+    if (!screen->two_files) {
+        file = fopen(screen->filename, "r+b");
+    } else if (start < half) {
+        file = fopen(screen->filename1, "r+b");
+    } else {
+        file = fopen(screen->filename2, "r+b");
+    }
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not update output file\n");
+        return;
     }
 
+    fseek(file, screen->two_files && start >= half ? start - half : start, SEEK_SET);
+
+    fwrite(screen->buffer + start, sizeof(u8), end - start, file);
+    fclose(file);
+}
+
+void write_palette(struct screen_s *screen, GifColorType *colormap, int color_count)
+{
+    FILE *file;
+    int i;
+
     for (i = 0; i < 16; i++) {
         u8 r = colormap[i].Red;
         u8 g = colormap[i].Green;
@@ -221,17 +648,22 @@ int main(int argc, char *argv[])
             ? ga_find_gate_array_firmware_color_code(r, g, b)
             : 0x00;
 
-        palette[i][0] = c;
-        palette[i][1] = fc;
+        screen->palette[i][0] = c;
+        screen->palette[i][1] = fc;
     }
 
     /* Print palette */
-    file = fopen(palname, "wb");
+    file = screen->palette_fd < 0 ? fopen(screen->palname, "wb") : fdopen(screen->palette_fd, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open the palette: %s\n", screen->palname);
+        exit(1);
+    }
 
-    fprintf(file, "pal_%s:     db ", basename_begin);
+    fprintf(file, "pal_%s:     db ", screen->basename_begin);
 
     for (i = 0; i < 16; i++) {
-        fprintf(file, "0x%x", palette[i][0]);
+        fprintf(file, "0x%x", screen->palette[i][0]);
 
         if (i != 15) {
             fprintf(file, ", ");
@@ -240,19 +672,702 @@ int main(int argc, char *argv[])
 
     fprintf(file, "\n");
     fclose(file);
-    printf("File %s is created.\n", palname);
 
-    file = fopen(pabname, "wb");
+    if (screen->palette_fd < 0) {
+        printf("File %s is created.\n", screen->palname);
+    } else {
+        printf("Palette is written to file descriptor %d.\n", screen->palette_fd);
+    }
+
+    file = fopen(screen->pabname, "wb");
     for (i = 0; i < 16; i++) {
-        u8 c = palette[i][1];
+        u8 c = screen->palette[i][1];
         fwrite(&c, 1, 1, file);
     }
     fclose(file);
-    printf("File %s is created.\n", pabname);
+    printf("File %s is created.\n", screen->pabname);
+}
+
+/*
+  Writes a version 1 snapshot of 64K showing the screen: the packed
+  screen at its addresses, the palette, the mode and CRTC settings of the
+  first region, and a jr $ loop with interrupts disabled in the first
+  256 byte page the screen does not use. Other regions need the raster
+  split code of the program itself.
+*/
+void write_sna(struct screen_s *screen)
+{
+    static const u8 crtc_defaults[18] = {
+        63, 40, 46, 0x8e, 38, 0, 25, 30, 0, 7, 0, 0, 0x30, 0, 0, 0, 0, 0
+    };
+    struct region_s *region;
+    u8 *sna;
+    u8 *memory;
+    u8 used[SNA_MEMORY_SIZE >> 8];
+    int code;
+    int y;
+    int i;
+    FILE *file;
+
+    region = &screen->regions[0];
+
+    sna = malloc(SNA_HEADER_SIZE + SNA_MEMORY_SIZE);
+    memset(sna, 0, SNA_HEADER_SIZE + SNA_MEMORY_SIZE);
+    memory = sna + SNA_HEADER_SIZE;
+
+    memcpy(memory, screen->buffer, screen->total_address_space);
+
+    /* Pages holding displayed bytes */
+    memset(used, 0, sizeof(used));
+
+    for (y = 0; y < screen->height * screen->repeat; y++) {
+        int addr = screen->repeat > 1 ? region->lines[y] : screen->lines[y];
+        int end = addr + row_bytes(screen, y / screen->repeat);
+
+        /* The other raster lines of repeated rows show copies */
+        if (y % screen->repeat) {
+            memcpy(memory + addr, screen->buffer + screen->lines[y / screen->repeat],
+                   row_bytes(screen, y / screen->repeat));
+        }
+
+        for (i = addr >> 8; i <= (end - 1) >> 8; i++) {
+            used[i] = 1;
+        }
+    }
+
+    for (code = 0; code < (int) sizeof(used) && used[code]; code++)
+        ;
+
+    if (code == (int) sizeof(used)) {
+        fprintf(stderr, "No free memory for the snapshot code\n");
+        exit(1);
+    }
+
+    code <<= 8;
+
+    memory[code] = 0x18;           /* jr $ */
+    memory[code + 1] = 0xfe;
+
+    memcpy(sna, "MV - SNA", 8);
+    sna[0x10] = 1;                 /* version */
+
+    sna[0x1b] = 0;                 /* IFF0, IFF1: di */
+    sna[0x1c] = 0;
+    sna[0x21] = (code + 0x100) & 0xff; /* SP at the end of the page */
+    sna[0x22] = ((code + 0x100) >> 8) & 0xff;
+    sna[0x23] = code & 0xff;       /* PC */
+    sna[0x24] = code >> 8;
+    sna[0x25] = 1;                 /* IM 1 */
+
+    /* Gate Array pens 0 to 15 and the border, in ink 0 */
+    for (i = 0; i < 16; i++) {
+        sna[0x2f + i] = screen->palette[i][0] & 0x1f;
+    }
+
+    sna[0x3f] = screen->palette[0][0] & 0x1f;
+
+    /* Both ROMs disabled, so that the screen can be anywhere */
+    sna[0x40] = 0x8c | region->mode;
+
+    memcpy(&sna[0x43], crtc_defaults, sizeof(crtc_defaults));
+
+    /* Syncs roughly centred around the displayed area of a 50 Hz frame */
+    sna[0x43 + 0] = region->regs.R0;
+    sna[0x43 + 1] = region->regs.R1;
+    sna[0x43 + 2] = region->regs.R1 + (region->regs.R0 + 1 - region->regs.R1) / 2 - 6;
+    sna[0x43 + 4] = FRAME_LINES / (region->regs.R9 + 1) - 1;
+    sna[0x43 + 5] = FRAME_LINES % (region->regs.R9 + 1);
+    sna[0x43 + 6] = region->regs.R6;
+    sna[0x43 + 7] = region->regs.R6 + (sna[0x43 + 4] + 1 - region->regs.R6) / 2 - 2;
+    sna[0x43 + 9] = region->regs.R9;
+    sna[0x43 + 12] = region->regs.R12;
+    sna[0x43 + 13] = region->regs.R13;
+
+    if (sna[0x43 + 2] < region->regs.R1 || sna[0x43 + 2] > region->regs.R0) {
+        sna[0x43 + 2] = region->regs.R1;
+    }
+
+    if (sna[0x43 + 7] < region->regs.R6 || sna[0x43 + 7] > sna[0x43 + 4]) {
+        sna[0x43 + 7] = region->regs.R6;
+    }
+
+    sna[0x59] = 0x82;              /* PPI control */
+    sna[0x5b + 7] = 0x3f;          /* PSG mixer, all channels off */
+
+    sna[0x6b] = (SNA_MEMORY_SIZE >> 10) & 0xff; /* memory size in K */
+    sna[0x6c] = SNA_MEMORY_SIZE >> 18;
+
+    file = fopen(screen->snaname, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not create file: %s\n", screen->snaname);
+        exit(1);
+    }
+
+    fwrite(sna, 1, SNA_HEADER_SIZE + SNA_MEMORY_SIZE, file);
+    fclose(file);
+    free(sna);
+
+    printf("File %s is created.\n", screen->snaname);
+}
+
+/*
+  Waits for the input file to change and converts it again. Only the
+  rows that differ from the previous image are packed and only their
+  bytes are rewritten in the output files.
+*/
+void watch(struct screen_s *screen, u8 *data, GifColorType *colormap, int color_count)
+{
+    int fd;
+    char dirname[256];
+    char *filename;
+    u8 *previous;
+    u8 *frame;
+    GifColorType previous_colormap[256];
+    int previous_color_count;
+
+    /* The frame is decoded into the same buffer on every change */
+    frame = malloc(screen->source_width * screen->height);
+    previous = malloc(screen->width * screen->height);
+    memcpy(previous, data, screen->width * screen->height);
+    memcpy(previous_colormap, colormap, color_count * sizeof(GifColorType));
+    previous_color_count = color_count;
+
+    /* Watch the directory, as editors often replace the file on save */
+    filename = strrchr(screen->inputfile, '/');
+
+    if (filename) {
+        sprintf(dirname, "%.*s", (int) (filename - screen->inputfile), screen->inputfile);
+        filename++;
+    } else {
+        strcpy(dirname, ".");
+        filename = screen->inputfile;
+    }
+
+    fd = inotify_init();
+
+    if (fd < 0 || inotify_add_watch(fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Could not watch directory: %s\n", dirname);
+        exit(1);
+    }
+
+    printf("Watching %s\n", screen->inputfile);
+    fflush(stdout);
+
+    while (1) {
+        long events[1024];         /* aligned for struct inotify_event */
+        struct inotify_event *event;
+        struct gif_info_s info;
+        struct timespec t1, t2;
+        int len;
+        int offset;
+        int changed;
+        int y;
+
+        len = read(fd, events, sizeof(events));
+
+        if (len <= 0) {
+            break;
+        }
+
+        changed = 0;
+
+        for (offset = 0; offset < len; offset += sizeof(*event) + event->len) {
+            event = (struct inotify_event *) ((char *) events + offset);
+
+            if (event->len && strcmp(event->name, filename) == 0) {
+                changed = 1;
+            }
+        }
+
+        if (!changed) {
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        if (gif_read_info(screen->inputfile, &info) < 0) {
+            fprintf(stderr, "Unable to read gif file: %s\n", screen->inputfile);
+            continue;
+        }
+
+        if (info.width != screen->source_width || info.height != screen->height) {
+            fprintf(stderr, "Image size changed, restart to convert it.\n");
+            continue;
+        }
+
+        if (gif_read_frames(screen->inputfile, &info, frame, 1) != 1) {
+            fprintf(stderr, "Unable to read gif file: %s\n", screen->inputfile);
+            continue;
+        }
+
+        data = screen_data(screen, frame);
+        color_count = info.color_count;
+        colormap = info.colormap;
+
+        changed = 0;
+
+        for (y = 0; y < screen->height; y++) {
+            u8 *row = &data[y * screen->width];
+
+            if (memcmp(row, &previous[y * screen->width], screen->width) == 0) {
+                continue;
+            }
+
+            pack_rows(screen, data, y, y + 1);
+            compose_rows(screen, y, y + 1);
+
+            if (!screen->strip) {
+                update_screen(screen,
+                              screen->lines[y],
+                              screen->lines[y] + row_bytes(screen, y));
+            }
+            memcpy(&previous[y * screen->width], row, screen->width);
+            changed++;
+        }
+
+        if (changed && screen->strip) {
+            /* Stripped files have no fixed offsets per address */
+            write_screen(screen);
+        }
+
+        if (color_count != previous_color_count ||
+            memcmp(colormap, previous_colormap, color_count * sizeof(GifColorType)) != 0) {
+            write_palette(screen, colormap, color_count);
+            memcpy(previous_colormap, colormap, color_count * sizeof(GifColorType));
+            previous_color_count = color_count;
+        }
+
+        if (screen->sna) {
+            write_sna(screen);
+        }
+
+        if (data != frame) {
+            free(data);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        printf("%d rows updated in %.2f ms\n", changed,
+               (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_nsec - t1.tv_nsec) / 1000000.0);
+        fflush(stdout);
+    }
+
+    close(fd);
+    free(previous);
+    free(frame);
+}
+
+int main(int argc, char *argv[])
+{
+    struct gif_info_s info;
+    GifColorType *colormap;
+    struct screen_s screen;
+    int i;
+    int basename_len;
+    u8 *source;
+    u8 *data;
+    int color_count;
+    int watch_mode;
+    int crtc_given;
+    int amsdos;
+    char *name;
+    char *palette;
+
+    memset(&screen, 0, sizeof(screen));
+
+    watch_mode = 0;
+    crtc_given = 0;
+    amsdos = 0;
+    name = NULL;
+    palette = NULL;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s input.gif [--mode 1] [--crtc (R0) (R1) (R6) (R9) (R12) (R13)] [-2] [--watch] [--strip-gaps]\n"
+                "\t[--resample nearest|box] [--jobs 1] [--region (rows) (mode) (R0) (R1) (R6) (R9) (R12) (R13)]...\n"
+                "\t[--layer layer.gif (x) (y) [(transparent ink)]]...\n"
+                "\t[--stdout] [--palette file.pal] [--palette-fd 3] [--name name] [--amsdos] [--sna] [--line-repeat 2]\n"
+                "\n"
+                "\tinput.gif can be - to read the standard input, named stdin unless --name is given.\n"
+                "\t--amsdos limits the base name to the 8 characters of AMSDOS, longer names\n"
+                "\tare only rejected with it.\n"
+                "\t--sna also writes a snapshot showing the screen, to load in an emulator.\n"
+                "\tIts 312 line frame needs R9 from 2 to 31 and R6 within the frame, so\n"
+                "\t--line-repeat 1 and 2 cannot be used with it.\n"
+                "\t--line-repeat shows each row on that many raster lines, setting R9 to one less.\n"
+                "\tWith --crtc, its R9 must already be one less. R6 stays the number of rows\n"
+                "\tshown. Only the first raster line of each character row is stored, the\n"
+                "\tprogram copies it to the others, every 0x800 bytes. These lines wrap within\n"
+                "\t2K, so 1024 / R1 rows fit (25 with R1 40).\n", argv[0]);
+        exit(1);
+    }
+
+    screen.mode = 1;
+    screen.resample = -1;
+    screen.jobs = 1;
+    screen.palette_fd = -1;
+    screen.repeat = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-2") == 0) {
+            screen.two_files = 1;
+        }
+
+        if (strcmp(argv[i], "--watch") == 0) {
+            watch_mode = 1;
+        }
+
+        if (strcmp(argv[i], "--strip-gaps") == 0) {
+            screen.strip = 1;
+        }
+
+        if (strcmp(argv[i], "--stdout") == 0) {
+            screen.output = stdout;
+        }
+
+        if (strcmp(argv[i], "--sna") == 0) {
+            screen.sna = 1;
+        }
+
+        if (strcmp(argv[i], "--line-repeat") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1 || atoi(argv[i + 1]) > 8) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            screen.repeat = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--amsdos") == 0) {
+            amsdos = 1;
+        }
+
+        if (strcmp(argv[i], "--name") == 0 || strcmp(argv[i], "--palette") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i], "--name") == 0) {
+                name = argv[i + 1];
+            } else {
+                palette = argv[i + 1];
+            }
+        }
+
+        if (strcmp(argv[i], "--palette-fd") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 3) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            screen.palette_fd = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--resample") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i + 1], "nearest") == 0) {
+                screen.resample = RESAMPLE_NEAREST;
+            } else if (strcmp(argv[i + 1], "box") == 0) {
+                screen.resample = RESAMPLE_BOX;
+            } else {
+                fprintf(stderr, "Invalid resample filter: %s\n", argv[i + 1]);
+                exit(1);
+            }
+        }
+
+        if (strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            screen.jobs = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--mode") == 0) {
+            u8 n;
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            parse_num(argv[i + 1], &n);
+            screen.mode = n;
+        }
+
+        if (strcmp(argv[i], "--crtc") == 0) {
+            if (i + 6 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            crtc_given = 1;
+
+            parse_num(argv[i + 1], &regs.R0);
+            parse_num(argv[i + 2], &regs.R1);
+            parse_num(argv[i + 3], &regs.R6);
+            parse_num(argv[i + 4], &regs.R9);
+            parse_num(argv[i + 5], &regs.R12);
+            parse_num(argv[i + 6], &regs.R13);
+        }
+
+        if (strcmp(argv[i], "--layer") == 0) {
+            struct layer_s *layer;
+
+            if (i + 3 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            screen.layers = realloc(screen.layers, (screen.layer_count + 1) * sizeof(struct layer_s));
+            layer = &screen.layers[screen.layer_count++];
+
+            layer->inputfile = argv[i + 1];
+            layer->x = atoi(argv[i + 2]);
+            layer->y = atoi(argv[i + 3]);
+            layer->ink = -1;
+
+            /* The transparent ink is optional */
+            if (i + 4 < argc && argv[i + 4][0] >= '0' && argv[i + 4][0] <= '9') {
+                layer->ink = atoi(argv[i + 4]);
+            }
+        }
+
+        if (strcmp(argv[i], "--region") == 0) {
+            struct region_s *region;
+            u8 n;
+
+            if (i + 8 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            screen.regions = realloc(screen.regions, (screen.region_count + 1) * sizeof(struct region_s));
+            region = &screen.regions[screen.region_count++];
+
+            region->rows = atoi(argv[i + 1]);
+            parse_num(argv[i + 2], &n);
+            region->mode = n;
+            parse_num(argv[i + 3], &region->regs.R0);
+            parse_num(argv[i + 4], &region->regs.R1);
+            parse_num(argv[i + 5], &region->regs.R6);
+            parse_num(argv[i + 6], &region->regs.R9);
+            parse_num(argv[i + 7], &region->regs.R12);
+            parse_num(argv[i + 8], &region->regs.R13);
+
+            if (region->rows < 1 || GET_PPB(region->mode) < 0) {
+                fprintf(stderr, "Invalid region\n");
+                exit(1);
+            }
+        }
+    }
+
+    if (screen.region_count && screen.resample >= 0) {
+        fprintf(stderr, "--resample cannot be used with --region\n");
+        exit(1);
+    }
+
+    if (screen.repeat && screen.region_count) {
+        fprintf(stderr, "--line-repeat cannot be used with --region\n");
+        exit(1);
+    }
+
+    /* Each image row takes a whole character row */
+    if (screen.repeat && crtc_given && regs.R9 != screen.repeat - 1) {
+        fprintf(stderr, "--line-repeat %d needs R9 %d, --crtc gives %d\n",
+                screen.repeat, screen.repeat - 1, regs.R9);
+        exit(1);
+    }
+
+    if (screen.repeat) {
+        if (!crtc_given && regs.R9 != screen.repeat - 1) {
+            printf("R9 set to %d for --line-repeat, %d raster lines shown\n",
+                   screen.repeat - 1, regs.R6 * screen.repeat);
+        }
+
+        regs.R9 = screen.repeat - 1;
+
+        printf("%d rows of %d bytes fit in the 2K block of unique lines\n",
+               regs.R1 ? 1024 / regs.R1 : 0, regs.R1 * 2);
+    } else {
+        screen.repeat = 1;
+    }
+
+    /* R4 counts at most 128 character rows and R5 at most 31 raster lines */
+    if (screen.sna) {
+        struct crtc_s *first = screen.region_count ? &screen.regions[0].regs : &regs;
+
+        if (first->R9 < 2 || first->R9 > 31) {
+            fprintf(stderr, "--sna needs R9 from 2 to 31 for a %d line frame, R9 is %d\n",
+                    FRAME_LINES, first->R9);
+            exit(1);
+        }
+
+        if (first->R6 > FRAME_LINES / (first->R9 + 1)) {
+            fprintf(stderr, "--sna needs R6 of %d rows at most for R9 %d, R6 is %d\n",
+                    FRAME_LINES / (first->R9 + 1), first->R9, first->R6);
+            exit(1);
+        }
+    }
+
+    if (screen.output && (screen.two_files || watch_mode)) {
+        fprintf(stderr, "--stdout cannot be used with -2 or --watch\n");
+        exit(1);
+    }
+
+    if (screen.palette_fd >= 0 && watch_mode) {
+        fprintf(stderr, "--palette-fd cannot be used with --watch\n");
+        exit(1);
+    }
+
+    if (screen.output) {
+        screen.output = stdout_output();
+    }
+
+    screen.ppb = GET_PPB(screen.mode);
+
+    if (screen.region_count) {
+        for (i = 0; i < screen.region_count; i++) {
+            struct region_s *region = &screen.regions[i];
+
+            printf("Region %d: %d rows, mode %d, R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
+                   i, region->rows, region->mode,
+                   region->regs.R0, region->regs.R1, region->regs.R6,
+                   region->regs.R9, region->regs.R12, region->regs.R13);
+        }
+    } else {
+        printf("R0: %d, R1: %d, R6: %d, R9: %d, R12: %d, R13: %d\n",
+               regs.R0, regs.R1, regs.R6, regs.R9, regs.R12, regs.R13);
+
+        printf("Mode %d\n", screen.mode);
+    }
+
+    screen.inputfile = argv[1];
+
+    if (strcmp(screen.inputfile, "-") != 0 && !strstr(screen.inputfile, ".gif")) {
+        fprintf(stderr, "File should have .gif extension.\n");
+        exit(1);
+    }
+
+    if (strcmp(screen.inputfile, "-") == 0 && watch_mode) {
+        fprintf(stderr, "The standard input cannot be watched\n");
+        exit(1);
+    }
+
+    if (name) {
+        sprintf(screen.basename, "%.200s", name);
+    } else if (strcmp(screen.inputfile, "-") == 0) {
+        sprintf(screen.basename, "stdin");
+    } else {
+        basename_len = strstr(screen.inputfile, ".gif") - screen.inputfile;
+
+        sprintf(screen.basename, "%.*s", basename_len < 200 ? basename_len : 200, screen.inputfile);
+    }
+
+    screen.basename_begin = screen.basename;
+
+    if (strrchr(screen.basename, '/')) {
+        screen.basename_begin = strrchr(screen.basename, '/') + 1;
+    }
+
+    sprintf(screen.palname, "%s.pal", screen.basename_begin);
+    sprintf(screen.pabname, "%s.pab", screen.basename_begin);
+    sprintf(screen.mapname, "%s.map", screen.basename_begin);
+    sprintf(screen.snaname, "%s.sna", screen.basename_begin);
+
+    if (palette) {
+        sprintf(screen.palname, "%.255s", palette);
+    }
+
+    if (amsdos && strlen(screen.basename_begin) > 8) {
+        fprintf(stderr, "File base name cannot be longer than 8 characters: %s.\n", screen.basename);
+        exit(1);
+    }
+
+    if (screen.two_files) {
+        sprintf(screen.filename1, "%s1.bin", screen.basename_begin);
+        sprintf(screen.filename2, "%s2.bin", screen.basename_begin);
+    } else {
+        sprintf(screen.filename, "%s.bin", screen.basename_begin);
+    }
+
+    source = gif_load(screen.inputfile, &info);
+
+    if (source == NULL) {
+        exit(1);
+    }
+
+    color_count = info.color_count;
+    colormap = info.colormap;
+
+    screen.source_width = info.width;
+    screen.width = info.width;
+    screen.height = info.height;
+
+    if (screen.resample >= 0) {
+        screen.width = resample_width(screen.mode, screen.width);
+        printf("resampled: %dx%d -> %dx%d\n",
+               screen.source_width, screen.height, screen.width, screen.height);
+    }
+
+    data = screen_data(&screen, source);
+
+    printf("width: %d, height: %d, color_count: %d\n", screen.width, screen.height, color_count);
+
+    if (screen.height - 1 < 0) {
+        fprintf(stderr, "Invalid data\n");
+        exit(1);
+    }
+
+    init_regions(&screen);
+
+    printf("%.4x\n", screen.lines[screen.height - 1]);
+
+    screen.buffer = malloc(screen.total_address_space);
+    memset(screen.buffer, 0, screen.total_address_space);
+
+    printf("total_address_space: %d (0x%.4x)\n", screen.total_address_space, screen.total_address_space);
+
+    screen.split = find_split(&screen);
+
+    if (screen.strip) {
+        find_runs(&screen);
+    }
+
+    load_layers(&screen, colormap, color_count);
+
+    pack_rows(&screen, data, 0, screen.height);
+
+    compose_rows(&screen, 0, screen.height);
+
+    write_screen(&screen);
+
+    write_palette(&screen, colormap, color_count);
+
+    if (screen.sna) {
+        write_sna(&screen);
+    }
+
+    if (watch_mode) {
+        watch(&screen, data, colormap, color_count);
+    }
+
+    free_regions(&screen);
+    free_layers(&screen);
+    free(screen.buffer);
+    free(screen.runs);
+
+    if (data != source) {
+        free(data);
+    }
 
-    free(lines);
-    free(buffer);
-    DGifCloseFile(gif_file_type, &error_code);
+    free(source);
 
     return 0;
 }
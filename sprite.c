@@ -1,26 +1,68 @@
 /*
  * Tool to take a gif file and convert it into the CPC screen format.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <gif_lib.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "ga.h"
+#include "gif.h"
+#include "resample.h"
 
 typedef unsigned char u8;
 typedef unsigned short u16;
 
+/* Transparent ink unless --transparent is given */
 #define MASK_COL_INDEX 4
 
+/* CPC Plus hardware sprites are 16x16 pixels, a byte per pixel */
+#define ASIC_SIZE 16
+
+/* Most threads --jobs can ask for */
+#define MAX_JOBS 64
+
+/* Skip list operations, with the byte count in the low 6 bits */
+#define SKIP_END 0x00              /* end of row */
+#define SKIP_SKIP 0x40             /* transparent bytes, skipped */
+#define SKIP_COPY 0x80             /* opaque pixel bytes */
+#define SKIP_MASK 0xc0             /* mask and pixel byte pairs */
+#define SKIP_MAX 0x3f
+
 struct args_s {
     int mode;                    /* screen mode */
     int no_mask;                 /* 1 if mask data is to generate */
     int no_offsets;              /* 1 if offsetted sprites to be generated */
+    int shift_table;             /* 1 if shift tables replace offset pages */
+    int trim;                    /* 1 if transparent borders are trimmed */
+    int mask_table;              /* 1 if a mask table replaces mask data */
+    int jobs;                    /* number of threads to render with */
+    int mask_col_index;          /* transparent ink, -1 for automatic */
+    int mirror;                  /* 1 if mirrored pages are added */
+    int flip_table;              /* 1 if the flip table is to generate */
+    int collision;               /* 0: none, 1: bit per pixel, 2: bit per byte */
+    int resample;                /* resample filter, -1 if not resampled */
+    int asic;                    /* 1 if CPC Plus hardware sprites are created */
+    int magnify_x;               /* ASIC sprite magnification: 1, 2 or 4 */
+    int magnify_y;
+    int unpack;                  /* 1 if ASIC sprites are unpacked to a gif */
+    int skip_list;               /* 1 if the skip list format is created */
+    int amsdos;                  /* 1 if names are limited to 8 characters */
+    char *name;                  /* output base name instead of the input's */
+    char *palette;               /* palette file instead of the .pal */
+    int palette_fd;              /* palette file descriptor, -1 for a file */
+    FILE *output;                /* binary output with --stdout, else NULL */
     char *inputfile;             /* input file argument */
+    char **inputs;               /* every input file, with --shared-palette */
+    int input_count;
+    int shared_palette;          /* 1 if the inputs share one palette */
+    char *fixed_palette;         /* .pal whose inks the shared palette keeps, or NULL */
 };
 
 struct gif_s {
@@ -30,20 +72,41 @@ struct gif_s {
     int width;
     int height;
 
-    GifFileType *_gif_file_type;
+    struct gif_info_s _info;
+    u8 *_data;                     /* decoded first frame */
+    u8 *_resampled;
+};
+
+struct page_s {
+    int x;                         /* first byte column kept */
+    int y;                         /* first row kept */
+    int width;                     /* kept bytes per row, without mask */
+    int height;                    /* kept rows */
+    int offset;                    /* offset of the page in the output */
 };
 
 struct config_s {
     int ppb;                       /* pixels per byte for given mode */
     char filename[256];            /* output .bin file to create */
     char palname[256];             /* output .pal for palette data */
+    char shfname[256];             /* output shift tables for the mode */
+    char tblname[256];             /* output .tbl for trimmed page table */
+    char mskname[256];             /* output mask table for the mode */
+    char flpname[256];             /* output flip table for the mode */
+    char colname[256];             /* output .col for collision bitmaps */
+    char sprname[256];             /* output .spr for ASIC sprite attributes */
+    char unpname[256];             /* ASIC sprites unpacked to a gif */
+    char skpname[256];             /* output .skp in the skip list format */
     char basename[256];            /* input file full path without extension  */
     char *basename_filename;       /* input file without path and extension */
     int buffer_size;
     u8 *buffer;                    /* in memory buffer to be used for data */
     int sub_byte_offset;           /* byte offset for the next offset buffer */
     int num_page;                  /* number of offset buffers */
+    int num_image;                 /* offset buffers and their mirrors */
     int mask_coef;                 /* 2 if there's mask, 1 if none */
+    int page_size;                 /* bytes of a single unshifted sprite */
+    struct page_s *pages;          /* trimmed page table, if trimming */
 };
 
 void write_file(char *filename, u8* buffer, int buffer_size)
@@ -55,7 +118,66 @@ void write_file(char *filename, u8* buffer, int buffer_size)
     fclose(file);
 }
 
+/* Writes the main output to its file, or to the standard output */
+void write_output(char *filename, FILE *output, u8 *buffer, int buffer_size)
+{
+    if (output == NULL) {
+        write_file(filename, buffer, buffer_size);
+        return;
+    }
+
+    fwrite(buffer, sizeof(u8), buffer_size, output);
+    fflush(output);
+}
+
+/*
+  Keeps a stream of the standard output for the binary output and sends
+  everything printed to the standard error instead.
+*/
+static FILE *stdout_output(void)
+{
+    FILE *output;
+
+    fflush(stdout);
+
+    output = fdopen(dup(1), "wb");
+
+    if (output == NULL || dup2(2, 1) < 0) {
+        fprintf(stderr, "Could not redirect the standard output\n");
+        exit(1);
+    }
+
+    return output;
+}
+
+/* Opens the palette file, or the file descriptor unless it is -1 */
+FILE *open_palette(char *palname, int palette_fd)
+{
+    FILE *file;
+
+    file = palette_fd < 0 ? fopen(palname, "wb") : fdopen(palette_fd, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open the palette: %s\n", palname);
+        exit(1);
+    }
+
+    return file;
+}
+
+void close_palette(FILE *file, char *palname, int palette_fd)
+{
+    fclose(file);
+
+    if (palette_fd < 0) {
+        printf("File %s is created.\n", palname);
+    } else {
+        printf("Palette is written to file descriptor %d.\n", palette_fd);
+    }
+}
+
 void write_palette(char *palname,
+                   int palette_fd,
                    char *basename_filename,
                    GifColorType *colormap,
                    int color_count)
@@ -63,7 +185,7 @@ void write_palette(char *palname,
     FILE *file;
     int i;
 
-    file = fopen(palname, "wb");
+    file = open_palette(palname, palette_fd);
 
     fprintf(file, "pal_%s:     db ", basename_filename);
     for (i = 0; i < 16; i++) {
@@ -83,247 +205,1785 @@ void write_palette(char *palname,
     }
     fprintf(file, "\n");
 
-    printf("File %s is created.\n", palname);
+    close_palette(file, palname, palette_fd);
 }
 
-void parse_args(int argc, char *argv[], struct args_s *args)
+/* Writes the 12 bit palette of ASIC sprite inks 1 to 15 */
+void write_plus_palette(char *palname,
+                        int palette_fd,
+                        char *basename_filename,
+                        GifColorType *colormap,
+                        int color_count,
+                        u16 *palette)
 {
+    FILE *file;
     int i;
 
-    assert(args);
+    file = open_palette(palname, palette_fd);
 
-    args->mode = 1;
-    args->no_mask = 0;
-    args->no_offsets = 0;
+    fprintf(file, "pal_%s:     dw ", basename_filename);
+    for (i = 1; i < 16; i++) {
+        palette[i] = i < color_count
+            ? ga_plus_color(colormap[i].Red, colormap[i].Green, colormap[i].Blue)
+            : 0x000;
 
-    if (argc < 2) {
-        printf("Usage: %s input.gif [--mode 1] [--no-mask] [--no-offsets]\n", argv[0]);
-        printf("\n");
-        printf("\t--no-mask\tDo not create interleaved mask data.\n");
-        printf("\t--no-offsets\tDo not create byte offsets.\n");
-        exit(0);
+        fprintf(file, "0x%.3x", palette[i]);
+
+        if (i != 15) {
+            fprintf(file, ", ");
+        }
     }
+    fprintf(file, "\n");
 
-    for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--mode") == 0) {
-            if (i + 1 >= argc) {
-                fprintf(stderr, "Invalid arguments\n");
-                exit(1);
-            }
+    close_palette(file, palname, palette_fd);
+}
 
-            args->mode = atoi(argv[i + 1]);
-        }
+/*
+  Writes the shift tables for a mode, so that the sprite can be
+  stored unshifted and shifted at blit time on CPC.
+
+  For each pixel shift s in 1..ppb-1 there are two 256 byte tables:
+  the first one holds the pixels of a byte moved s pixels to the
+  right, the second one holds the pixels that spill into the next
+  byte. A shifted byte is then stay[b] | spill[previous b]. Mask
+  bytes are shifted the same way, starting with previous b as 0xff.
+*/
+void write_shift_tables(char *shfname, int mode)
+{
+    int ppb;
+    int s, b, o;
+    u8 *tables;
+    int tables_size;
 
-        if (strcmp(argv[i], "--no-mask") == 0) {
-            args->no_mask = 1;
-        }
+    ppb = GET_PPB(mode);
+    tables_size = (ppb - 1) * 2 * 256;
+    tables = malloc(tables_size);
 
-        if (strcmp(argv[i], "--no-offsets") == 0) {
-            args->no_offsets = 1;
+    memset(tables, 0, tables_size);
+
+    for (s = 1; s < ppb; s++) {
+        u8 *stay = tables + (s - 1) * 2 * 256;
+        u8 *spill = stay + 256;
+
+        for (b = 0; b < 256; b++) {
+            for (o = 0; o < ppb; o++) {
+                int c = ga_pixel_ink(mode, b, o);
+
+                if (o + s < ppb) {
+                    stay[b] |= ga_pixel_byte(mode, c, o + s);
+                } else {
+                    spill[b] |= ga_pixel_byte(mode, c, o + s - ppb);
+                }
+            }
         }
     }
 
-    args->inputfile = argv[1];
+    write_file(shfname, tables, tables_size);
+
+    printf("File %s is created.\n", shfname);
+
+    free(tables);
 }
 
-void gif_open(char *inputfile, struct gif_s *gif)
+/*
+  Writes the 256 byte mask table for a mode. The pixel byte indexes the
+  table and gives the AND mask that keeps the screen pixels behind the
+  pixels of the transparent ink, so no mask data needs to be stored.
+*/
+void write_mask_table(char *mskname, int mode, int mask_col_index)
 {
-    int error_code;
-    GifFileType *gif_file_type;
+    int ppb;
+    int b, o;
+    int mask_ink;
+    u8 table[256];
 
-    assert(gif);
+    ppb = GET_PPB(mode);
 
-    memset(gif, 0, sizeof(*gif));
+    /* The ink the transparent pixels end up with in the pixel data */
+    mask_ink = ga_pixel_ink(mode, ga_pixel_byte(mode, mask_col_index, 0), 0);
 
-    gif_file_type = DGifOpenFileName(inputfile, &error_code);
+    for (b = 0; b < 256; b++) {
+        table[b] = 0;
 
-    if (gif_file_type == NULL || error_code == E_GIF_ERR_OPEN_FAILED) {
-        fprintf(stderr, "Could not open file: %s\n", inputfile);
-        exit(1);
+        for (o = 0; o < ppb; o++) {
+            if (ga_pixel_ink(mode, b, o) == mask_ink) {
+                table[b] |= ga_pixel_mask(mode, o);
+            }
+        }
     }
 
-    if (DGifSlurp(gif_file_type) == GIF_ERROR) {
-        fprintf(stderr, "Unable to read gif file: %s\n", inputfile);
-        exit(1);
-    }
+    write_file(mskname, table, sizeof(table));
 
+    printf("File %s is created.\n", mskname);
+}
 
-    gif->color_count = gif_file_type->SColorMap->ColorCount;
-    gif->colormap = gif_file_type->SColorMap[0].Colors;
+/*
+  Builds the table that reverses the order of the pixels in a byte of
+  the mode, for pixel and mask bytes alike.
+*/
+void make_flip_table(u8 *table, int mode)
+{
+    int ppb;
+    int b, o;
 
-    gif->width = gif_file_type->SWidth;
-    gif->height = gif_file_type->SHeight;
+    ppb = GET_PPB(mode);
 
-    gif->data = gif_file_type->SavedImages[0].RasterBits;
+    for (b = 0; b < 256; b++) {
+        table[b] = 0;
 
-    gif->_gif_file_type = gif_file_type;
+        for (o = 0; o < ppb; o++) {
+            table[b] |= ga_pixel_byte(mode, ga_pixel_ink(mode, b, o), ppb - 1 - o);
+        }
+    }
 }
 
-void gif_free(struct gif_s *gif)
+void write_flip_table(char *flpname, int mode)
 {
-    int error_code;
+    u8 table[256];
+
+    make_flip_table(table, mode);
 
-    DGifCloseFile(gif->_gif_file_type, &error_code);
+    write_file(flpname, table, sizeof(table));
+
+    printf("File %s is created.\n", flpname);
 }
 
-void parse_config(struct config_s *config, struct args_s *args, struct gif_s *gif)
+/*
+  Writes a collision bitmap for every page: a set bit for each opaque
+  pixel (or for each byte with an opaque pixel when per_byte is given),
+  most significant bit first, rows padded to whole bytes. Pages are in
+  the same order as in the .bin, so two sprites collide if the AND of
+  their overlapping rows is not zero.
+*/
+void write_collision(char *colname,
+                     int width,
+                     int height,
+                     int num_page,
+                     int mirror,
+                     int ppb,
+                     int per_byte,
+                     int mask_col_index,
+                     u8 *data)
 {
-    int basename_len;
+    FILE *file;
+    u8 *bitmap;
+    int bits;
+    int row_len;
+    int size;
+    int y, x, k;
 
-    assert(config);
+    /* Bits per row, either one per pixel or one per screen byte */
+    bits = per_byte ? width / ppb : width;
+    row_len = (bits + 7) / 8;
+    size = row_len * height;
 
-    config->ppb = GET_PPB(args->mode);
+    bitmap = malloc(size);
 
-    basename_len = strstr(args->inputfile, ".gif") - args->inputfile;
+    file = fopen(colname, "wb");
 
-    sprintf(config->basename, "%.*s", basename_len, args->inputfile);
+    for (k = 0; k < num_page * (mirror ? 2 : 1); k++) {
+        int shift = k % num_page;
 
-    config->basename_filename = config->basename;
+        memset(bitmap, 0, size);
 
-    if (strrchr(config->basename, '/')) {
-        config->basename_filename = strrchr(config->basename, '/') + 1;
-    }
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                /* Mirrored pages read the shifted page from the right */
+                int sx = k < num_page ? x : width - 1 - x;
+                int c = (sx - shift) < 0 ? mask_col_index : data[y * width + sx - shift];
+                int bit = per_byte ? x / ppb : x;
 
-    if (strlen(config->basename_filename) > 8) {
-        fprintf(stderr, "File base name cannot be longer than 8 characters: %s.\n", config->basename);
-        exit(1);
+                if (c != mask_col_index) {
+                    bitmap[y * row_len + bit / 8] |= 0x80 >> (bit % 8);
+                }
+            }
+        }
+
+        fwrite(bitmap, 1, size, file);
     }
 
-    sprintf(config->filename, "%s.bin", config->basename_filename);
-    sprintf(config->palname, "%s.pal", config->basename_filename);
+    fclose(file);
 
-    config->buffer_size = gif->height * gif->width / config->ppb;
+    free(bitmap);
 
-    if (!args->no_mask) {
-        /* multiplied by 2 because we need mask data */
-        config->buffer_size *= 2;
-    }
+    printf("File %s is created (%d bytes per page).\n", colname, size);
+}
 
-    if (!args->no_offsets) {
-        /* multiplied by ppb because we need a sprite for each sub-byte position */
-        config->buffer_size *= config->ppb;
-    }
+/*
+  Writes the ASIC attributes of the sprite cells: position relative to
+  the first cell and magnification, padded to the 8 bytes of each
+  sprite in the ASIC page so that they can be copied as they are.
+*/
+void write_asic_table(char *sprname,
+                      char *basename_filename,
+                      int cells_x,
+                      int cells_y,
+                      int magnify_x,
+                      int magnify_y)
+{
+    FILE *file;
+    int mag;
+    int x, y;
 
-    config->buffer = malloc(config->buffer_size);
+    /* 1, 2 and 4 times are 1, 2 and 3 in the magnification bits */
+    mag = (magnify_x == 4 ? 3 : magnify_x) << 2 | (magnify_y == 4 ? 3 : magnify_y);
 
-    memset(config->buffer, 0, config->buffer_size);
+    file = fopen(sprname, "wb");
 
-    printf("width: %d, height: %d, color_count: %d\n",
-           gif->width, gif->height, gif->color_count);
+    fprintf(file, "sprites_%s: ; %d sprites\n", basename_filename, cells_x * cells_y);
+    for (y = 0; y < cells_y; y++) {
+        for (x = 0; x < cells_x; x++) {
+            fprintf(file, "    dw %d, %d\n",
+                    x * ASIC_SIZE * magnify_x, y * ASIC_SIZE * magnify_y);
+            fprintf(file, "    db 0x%.2x, 0, 0, 0 ; sprite %d: x, y, magnification\n",
+                    mag, y * cells_x + x);
+        }
+    }
 
-    /* For mask data we need twice the space */
-    config->mask_coef = args->no_mask ? 1 : 2;
+    fclose(file);
 
-    /* If offsets included, how much to jump ahead for next offset buffer */
-    config->sub_byte_offset = (gif->height * gif->width)
-        / (config->ppb * config->mask_coef);
+    printf("File %s is created.\n", sprname);
 
-    /* Number of images for each offset */
-    config->num_page = args->no_offsets ? 1 : config->ppb;
+    if (cells_x * cells_y > 16) {
+        printf("%d sprites, the ASIC has 16\n", cells_x * cells_y);
+    }
 }
 
-void config_free(struct config_s *config)
+/* Kind of operation for the mask byte of a pixel byte */
+int skip_op(u8 mask)
 {
-    assert(config);
-
-    free(config->buffer);
+    return mask == 0xff ? SKIP_SKIP : mask == 0x00 ? SKIP_COPY : SKIP_MASK;
 }
 
-void render(int width,
-            int height,
-            int mode,
-            int num_page,
-            int ppb,
-            int sub_byte_offset,
-            int no_mask,
-            int mask_coef,
-            u8 *data,
-            u8 *buffer)
+/*
+  Encodes the rendered pages as rows of operations, for a blitter that
+  jumps over transparent bytes without reading them:
+
+    SKIP_SKIP | n    skip n screen bytes
+    SKIP_COPY | n    n pixel bytes follow, written as they are
+    SKIP_MASK | n    n mask and pixel byte pairs follow
+    SKIP_END         next row, transparent bytes left on the row are skipped
+
+  The file starts with the little endian offset of every page.
+*/
+void write_skip_list(char *skpname,
+                     int width,
+                     int height,
+                     int num_image,
+                     int ppb,
+                     int page_size,
+                     u8 *buffer)
 {
+    u8 *out;
+    int len;
+    int row_bytes;
     int y, x, k;
 
-    /* For each offset image */
-    for (k = 0; k < num_page; k++) {
+    row_bytes = width / ppb;
+
+    /* The worst case is a masked pair run of one byte each */
+    out = malloc(num_image * 2 + num_image * height * (row_bytes * 3 + 1));
+    len = num_image * 2;
+
+    for (k = 0; k < num_image; k++) {
+        out[k * 2 + 0] = len & 0xff;
+        out[k * 2 + 1] = (len >> 8) & 0xff;
+
         for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                int c = (x - k) < 0 ? MASK_COL_INDEX : data[y * width + x - k];
-                int mask_it = c == MASK_COL_INDEX;
-                int offset = x % ppb;
-                int page = sub_byte_offset * k;
-                int scanline_len;
-                int x_byte_offset;
-                u8 *pixel_addr;
-                u8 *mask_addr;
-
-                if (!no_mask) {
-                    scanline_len = width / ppb * mask_coef;
-                    x_byte_offset = x / ppb * mask_coef;
-                    /* Interlace sprite with masked data one byte interleaved */
-                    pixel_addr = &buffer[y * scanline_len + (x_byte_offset + 1) + page];
-                    mask_addr = &buffer[y * scanline_len + (x_byte_offset + 0) + page];
-                } else {
-                    scanline_len = width / ppb;
-                    x_byte_offset = x / ppb;
-                    pixel_addr = &buffer[y * scanline_len + x_byte_offset + page];
-                }
+            u8 *row = buffer + k * page_size + y * row_bytes * 2;
+            int end = row_bytes;
 
-                if (mode == 2) {
-                    int m = 1; /* mask color */
+            /* Trailing transparent bytes are left to the end of row */
+            while (end > 0 && row[(end - 1) * 2] == 0xff) {
+                end--;
+            }
 
-                    *pixel_addr |= MODE_2_PF(c, offset);
-                    if (!no_mask && mask_it) {
-                        *mask_addr |= MODE_2_PF(m, offset);
-                    }
-                } else if (mode == 1) {
-                    int m = 3; /* mask color */
+            for (x = 0; x < end;) {
+                int op = skip_op(row[x * 2]);
+                int n;
+                int i;
+
+                for (n = 1; x + n < end && n < SKIP_MAX && skip_op(row[(x + n) * 2]) == op; n++)
+                    ;
+
+                out[len++] = op | n;
 
-                    *pixel_addr |= MODE_1_PF(c, offset);
-                    if (!no_mask && mask_it) {
-                        *mask_addr |= MODE_1_PF(m, offset);
+                for (i = x; i < x + n; i++) {
+                    if (op == SKIP_MASK) {
+                        out[len++] = row[i * 2];
                     }
-                } else if (mode == 0) {
-                    int m = 15; /* mask color */
 
-                    *pixel_addr |= MODE_0_PF(c, offset);
-                    if (!no_mask && mask_it) {
-                        *mask_addr |= MODE_0_PF(m, offset);
+                    if (op != SKIP_SKIP) {
+                        out[len++] = row[i * 2 + 1];
                     }
                 }
+
+                x += n;
             }
+
+            out[len++] = SKIP_END;
         }
     }
+
+    if (len > 0xffff) {
+        fprintf(stderr, "Skip list does not fit 64K: %d bytes\n", len);
+        exit(1);
+    }
+
+    write_file(skpname, out, len);
+
+    printf("skip list: %d -> %d bytes\n", page_size * num_image, len);
+
+    free(out);
 }
 
-int main(int argc, char *argv[])
+void write_page_table(char *tblname,
+                      char *basename_filename,
+                      struct page_s *pages,
+                      int num_page)
 {
-    struct args_s args;
-    struct gif_s gif;
-    struct config_s config;
+    FILE *file;
+    int k;
 
-    parse_args(argc, argv, &args);
+    file = fopen(tblname, "wb");
+
+    fprintf(file, "pages_%s:\n", basename_filename);
+    for (k = 0; k < num_page; k++) {
+        fprintf(file, "    db %d, %d, %d, %d ; page %d: x, y, width, height\n",
+                pages[k].x, pages[k].y, pages[k].width, pages[k].height, k);
+        fprintf(file, "    dw 0x%.4x\n", pages[k].offset);
+    }
 
-    gif_open(args.inputfile, &gif);
+    fclose(file);
 
-    parse_config(&config, &args, &gif);
+    printf("File %s is created.\n", tblname);
+}
 
-    render(gif.width,
-           gif.height,
-           args.mode,
-           config.num_page,
-           config.ppb,
-           config.sub_byte_offset,
-           args.no_mask,
-           config.mask_coef,
-           gif.data,
-           config.buffer);
+void parse_args(int argc, char *argv[], struct args_s *args)
+{
+    int i;
+    int transparent_given;
+    int ink_count;
 
-    write_file(config.filename, config.buffer, config.buffer_size);
+    assert(args);
 
-    write_palette(config.palname, config.basename_filename, gif.colormap, gif.color_count);
+    args->mode = 1;
+    args->no_mask = 0;
+    args->no_offsets = 0;
+    args->shift_table = 0;
+    args->trim = 0;
+    args->mask_table = 0;
+    args->jobs = 1;
+    args->mask_col_index = MASK_COL_INDEX;
+    args->mirror = 0;
+    args->flip_table = 0;
+    args->collision = 0;
+    args->resample = -1;
+    args->asic = 0;
+    args->magnify_x = 1;
+    args->magnify_y = 1;
+    args->unpack = 0;
+    args->skip_list = 0;
+    args->shared_palette = 0;
+    args->fixed_palette = NULL;
+    args->inputs = malloc(argc * sizeof(char *));
+    args->input_count = 0;
+    args->amsdos = 0;
+    args->name = NULL;
+    args->palette = NULL;
+    args->palette_fd = -1;
+    args->output = NULL;
+    transparent_given = 0;
 
-    config_free(&config);
+    if (argc < 2) {
+        printf("Usage: %s input.gif [--mode 1] [--no-mask] [--no-offsets] [--shift-table] [--trim] [--mask-table] [--jobs 1] [--transparent 4|auto]\n"
+               "\t[--mirror] [--flip-table] [--collision pixel|byte] [--resample nearest|box]\n"
+               "\t[--asic] [--magnify 1 1] [--unpack]\n"
+               "\t[--stdout] [--palette file.pal] [--palette-fd 3] [--name name] [--amsdos] [--skip-list]\n"
+               "\t[--shared-palette input.gif...] [--fixed-palette screen.pal]\n", argv[0]);
+        printf("\n");
+        printf("\t--no-mask\tDo not create interleaved mask data.\n");
+        printf("\t--no-offsets\tDo not create byte offsets.\n");
+        printf("\t--shift-table\tCreate shift tables for the mode instead of byte offsets.\n");
+        printf("\t--trim\t\tTrim transparent rows and byte columns of each page.\n");
+        printf("\t--mask-table\tCreate a mask table for the mode instead of mask data.\n"
+               "\t\t\tThe transparent ink is moved to ink 0, as the pixel bytes\n"
+               "\t\t\tare ORed onto the screen.\n");
+        printf("\t--jobs\t\tNumber of threads to render with, up to %d.\n", MAX_JOBS);
+        printf("\t--transparent\tTransparent ink, or auto to move the transparent colour\n"
+               "\t\t\tof the gif (or of the top left pixel) to ink 0.\n");
+        printf("\t--mirror\tAdd horizontally mirrored pages after the pages.\n");
+        printf("\t--flip-table\tCreate the flip table for the mode to mirror on CPC.\n");
+        printf("\t--collision\tCreate collision bitmaps of each page with a bit per\n"
+               "\t\t\tpixel, or a bit per screen byte.\n");
+        printf("\t--resample\tResample square pixel art to the pixel aspect of the mode.\n");
+        printf("\t--asic\t\tCreate 16x16 CPC Plus hardware sprites and their 12 bit palette.\n");
+        printf("\t--magnify\tHorizontal and vertical ASIC sprite magnification: 1, 2 or 4.\n");
+        printf("\t--unpack\tUnpack the ASIC sprites back to a gif to check them.\n");
+        printf("\t--stdout\tWrite the binary output to the standard output.\n");
+        printf("\t--palette\tWrite the palette to the given file.\n");
+        printf("\t--palette-fd\tWrite the palette to the given file descriptor.\n");
+        printf("\t--name\t\tBase name of the outputs, for - (standard input) too.\n");
+        printf("\t--amsdos\tLimit the base name to the 8 characters of AMSDOS. Longer\n"
+               "\t\t\tnames are only rejected with it.\n");
+        printf("\t--skip-list\tAlso create the pages as skip, copy and masked byte runs.\n");
+        printf("\t--shared-palette Convert every .gif argument against one palette found for\n"
+               "\t\t\tall of them, with --jobs inputs at a time.\n");
+        printf("\t--fixed-palette\tKeep the inks of a .pal written by screen, so that the\n"
+               "\t\t\tsprites share the palette of the screen they are shown on.\n");
+        exit(0);
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mode") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            args->mode = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--no-mask") == 0) {
+            args->no_mask = 1;
+        }
+
+        if (strcmp(argv[i], "--no-offsets") == 0) {
+            args->no_offsets = 1;
+        }
+
+        if (strcmp(argv[i], "--shift-table") == 0) {
+            args->shift_table = 1;
+        }
+
+        if (strcmp(argv[i], "--trim") == 0) {
+            args->trim = 1;
+        }
+
+        if (strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1 || atoi(argv[i + 1]) > MAX_JOBS) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            args->jobs = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--transparent") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i + 1], "auto") == 0) {
+                args->mask_col_index = -1;
+            } else {
+                char *end;
+                long ink = strtol(argv[i + 1], &end, 10);
+
+                if (end == argv[i + 1] || *end != 0 || ink < 0 || ink > 255) {
+                    fprintf(stderr, "Invalid transparent ink: %s\n", argv[i + 1]);
+                    exit(1);
+                }
+
+                args->mask_col_index = ink;
+            }
+
+            transparent_given = 1;
+        }
+
+        if (strcmp(argv[i], "--mirror") == 0) {
+            args->mirror = 1;
+        }
+
+        if (strcmp(argv[i], "--flip-table") == 0) {
+            args->flip_table = 1;
+        }
+
+        if (strcmp(argv[i], "--collision") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i + 1], "pixel") == 0) {
+                args->collision = 1;
+            } else if (strcmp(argv[i + 1], "byte") == 0) {
+                args->collision = 2;
+            } else {
+                fprintf(stderr, "Invalid collision bitmap: %s\n", argv[i + 1]);
+                exit(1);
+            }
+        }
+
+        if (strcmp(argv[i], "--resample") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i + 1], "nearest") == 0) {
+                args->resample = RESAMPLE_NEAREST;
+            } else if (strcmp(argv[i + 1], "box") == 0) {
+                args->resample = RESAMPLE_BOX;
+            } else {
+                fprintf(stderr, "Invalid resample filter: %s\n", argv[i + 1]);
+                exit(1);
+            }
+        }
+
+        if (strcmp(argv[i], "--asic") == 0) {
+            args->asic = 1;
+        }
+
+        if (strcmp(argv[i], "--magnify") == 0) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            args->magnify_x = atoi(argv[i + 1]);
+            args->magnify_y = atoi(argv[i + 2]);
+
+            if ((args->magnify_x != 1 && args->magnify_x != 2 && args->magnify_x != 4) ||
+                (args->magnify_y != 1 && args->magnify_y != 2 && args->magnify_y != 4)) {
+                fprintf(stderr, "Magnification can be 1, 2 or 4\n");
+                exit(1);
+            }
+        }
+
+        if (strcmp(argv[i], "--unpack") == 0) {
+            args->unpack = 1;
+        }
+
+        if (strcmp(argv[i], "--stdout") == 0) {
+            args->output = stdout;
+        }
+
+        if (strcmp(argv[i], "--amsdos") == 0) {
+            args->amsdos = 1;
+        }
+
+        if (strcmp(argv[i], "--skip-list") == 0) {
+            args->skip_list = 1;
+        }
+
+        if (strcmp(argv[i], "--shared-palette") == 0) {
+            args->shared_palette = 1;
+        }
+
+        if (strcmp(argv[i], "--fixed-palette") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            args->fixed_palette = argv[i + 1];
+        }
+
+        /* Later .gif arguments are more inputs */
+        if (i > 1 && strlen(argv[i]) > 4 && strcmp(argv[i] + strlen(argv[i]) - 4, ".gif") == 0) {
+            args->inputs[args->input_count++] = argv[i];
+        }
+
+        if (strcmp(argv[i], "--name") == 0 || strcmp(argv[i], "--palette") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            if (strcmp(argv[i], "--name") == 0) {
+                args->name = argv[i + 1];
+            } else {
+                args->palette = argv[i + 1];
+            }
+        }
+
+        if (strcmp(argv[i], "--palette-fd") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 3) {
+                fprintf(stderr, "Invalid arguments\n");
+                exit(1);
+            }
+
+            args->palette_fd = atoi(argv[i + 1]);
+        }
+
+        if (strcmp(argv[i], "--mask-table") == 0) {
+            /* Masks are looked up from the pixel bytes on CPC */
+            args->mask_table = 1;
+            args->no_mask = 1;
+        }
+    }
+
+    /* ASIC sprites have 16 inks whatever the mode */
+    ink_count = args->asic ? 16 : 1 << (8 / GET_PPB(args->mode));
+
+    if (transparent_given && args->mask_col_index >= ink_count) {
+        fprintf(stderr, "Transparent ink %d is not available in mode %d\n",
+                args->mask_col_index, args->mode);
+        exit(1);
+    }
+
+    /* The default ink would be cut to ink 0 in the table */
+    if (args->mask_table && !transparent_given && args->mask_col_index >= ink_count) {
+        fprintf(stderr, "Mode %d has no ink %d, give the transparent ink with --transparent\n",
+                args->mode, args->mask_col_index);
+        exit(1);
+    }
+
+    if (args->skip_list && (args->no_mask || args->asic)) {
+        fprintf(stderr, "--skip-list is made from the mask data, without --no-mask, --mask-table or --asic\n");
+        exit(1);
+    }
+
+    if (args->output && args->unpack) {
+        fprintf(stderr, "--unpack reads the output back and cannot be used with --stdout\n");
+        exit(1);
+    }
+
+    args->inputfile = argv[1];
+
+    if (strcmp(args->inputfile, "-") != 0 && !strstr(args->inputfile, ".gif")) {
+        fprintf(stderr, "File should have .gif extension.\n");
+        exit(1);
+    }
+
+    memmove(args->inputs + 1, args->inputs, args->input_count * sizeof(char *));
+    args->inputs[0] = args->inputfile;
+    args->input_count++;
+
+    if (args->input_count > 1 && !args->shared_palette) {
+        fprintf(stderr, "Several inputs are converted with --shared-palette only\n");
+        exit(1);
+    }
+
+    if (args->fixed_palette && !args->shared_palette) {
+        fprintf(stderr, "--fixed-palette is used with --shared-palette\n");
+        exit(1);
+    }
+
+    if (args->shared_palette &&
+        (args->output || args->name || args->palette || args->palette_fd >= 0 ||
+         args->asic || strcmp(args->inputfile, "-") == 0)) {
+        fprintf(stderr, "--shared-palette writes the outputs of each input, without -, --stdout,\n"
+                "--name, --palette, --palette-fd or --asic\n");
+        exit(1);
+    }
+
+    if (args->output) {
+        args->output = stdout_output();
+    }
+}
+
+void gif_open(char *inputfile, struct gif_s *gif)
+{
+    assert(gif);
+
+    memset(gif, 0, sizeof(*gif));
+
+    gif->_data = gif_read(inputfile, &gif->_info);
+
+    if (gif->_data == NULL) {
+        fprintf(stderr, "Unable to read gif file: %s\n", inputfile);
+        exit(1);
+    }
+
+    gif->color_count = gif->_info.color_count;
+    gif->colormap = gif->_info.colormap;
+
+    gif->width = gif->_info.width;
+    gif->height = gif->_info.height;
+
+    gif->data = gif->_data;
+}
+
+/* Swaps the ink with ink 0 in both the colour map and the image */
+void gif_move_to_zero(struct gif_s *gif, int transparent)
+{
+    GifColorType color;
+    int i;
+
+    printf("transparent colour: %d, moved to ink 0\n", transparent);
+
+    if (transparent == 0) {
+        return;
+    }
+
+    color = gif->colormap[0];
+    gif->colormap[0] = gif->colormap[transparent];
+    gif->colormap[transparent] = color;
+
+    for (i = 0; i < gif->width * gif->height; i++) {
+        if (gif->data[i] == transparent) {
+            gif->data[i] = 0;
+        } else if (gif->data[i] == 0) {
+            gif->data[i] = transparent;
+        }
+    }
+}
+
+/*
+  Moves the transparent colour of the gif, or the colour of the top
+  left pixel if the gif has none, to ink 0 by swapping it with ink 0 in
+  both the colour map and the image. Transparent pixels then have no
+  bits set in the pixel data, which allows an OR only blit on CPC.
+*/
+void gif_transparent_to_zero(struct gif_s *gif)
+{
+    int transparent;
+
+    transparent = gif->_info.transparent >= 0 ? gif->_info.transparent : gif->data[0];
+
+    gif_move_to_zero(gif, transparent);
+}
+
+/* Replaces the image with its copy at the pixel aspect of the mode */
+void gif_resample(struct gif_s *gif, int mode, int filter, int jobs)
+{
+    int width;
+
+    width = resample_width(mode, gif->width);
+
+    gif->_resampled = resample(gif->data, gif->width, gif->height, width, filter, jobs);
+
+    printf("resampled: %dx%d -> %dx%d\n", gif->width, gif->height, width, gif->height);
+
+    gif->data = gif->_resampled;
+    gif->width = width;
+}
+
+void gif_free(struct gif_s *gif)
+{
+    free(gif->_data);
+    free(gif->_resampled);
+}
+
+void parse_config(struct config_s *config, struct args_s *args, struct gif_s *gif)
+{
+    int basename_len;
+
+    assert(config);
+
+    config->ppb = GET_PPB(args->mode);
+
+    if (args->name) {
+        sprintf(config->basename, "%.200s", args->name);
+    } else if (strcmp(args->inputfile, "-") == 0) {
+        sprintf(config->basename, "stdin");
+    } else {
+        basename_len = strstr(args->inputfile, ".gif") - args->inputfile;
+
+        sprintf(config->basename, "%.*s", basename_len < 200 ? basename_len : 200, args->inputfile);
+    }
+
+    config->basename_filename = config->basename;
+
+    if (strrchr(config->basename, '/')) {
+        config->basename_filename = strrchr(config->basename, '/') + 1;
+    }
+
+    if (args->amsdos && strlen(config->basename_filename) > 8) {
+        fprintf(stderr, "File base name cannot be longer than 8 characters: %s.\n", config->basename);
+        exit(1);
+    }
+
+    sprintf(config->filename, "%s.bin", config->basename_filename);
+    sprintf(config->palname, "%s.pal", config->basename_filename);
+    sprintf(config->shfname, "shift%d.bin", args->mode);
+    sprintf(config->tblname, "%s.tbl", config->basename_filename);
+    sprintf(config->mskname, "mask%d.bin", args->mode);
+    sprintf(config->flpname, "flip%d.bin", args->mode);
+    sprintf(config->colname, "%s.col", config->basename_filename);
+    sprintf(config->sprname, "%s.spr", config->basename_filename);
+    sprintf(config->unpname, "%s-asic.gif", config->basename_filename);
+    sprintf(config->skpname, "%s.skp", config->basename_filename);
+
+    if (args->palette) {
+        sprintf(config->palname, "%.255s", args->palette);
+    }
+
+    /* For mask data we need twice the space */
+    config->mask_coef = args->no_mask ? 1 : 2;
+
+    config->page_size = gif->height * gif->width / config->ppb * config->mask_coef;
+
+    /* Number of images for each offset */
+    config->num_page = args->no_offsets || args->shift_table ? 1 : config->ppb;
+
+    /* If offsets included, how much to jump ahead for next offset buffer */
+    config->sub_byte_offset = config->page_size;
+
+    /* Mirrored pages follow the pages */
+    config->num_image = config->num_page * (args->mirror ? 2 : 1);
+
+    /* multiplied by num_page because we need a sprite for each sub-byte position */
+    config->buffer_size = config->page_size * config->num_image;
+
+    config->buffer = malloc(config->buffer_size);
+
+    memset(config->buffer, 0, config->buffer_size);
+
+    config->pages = NULL;
+
+    if (args->trim) {
+        config->pages = malloc(config->num_image * sizeof(struct page_s));
+    }
+
+    printf("width: %d, height: %d, color_count: %d\n",
+           gif->width, gif->height, gif->color_count);
+}
+
+void config_free(struct config_s *config)
+{
+    assert(config);
+
+    free(config->buffer);
+    free(config->pages);
+}
+
+/* Renders the rows y1 to y2 (exclusive) of offset image k */
+void render_rows(int width,
+                 int mode,
+                 int k,
+                 int y1,
+                 int y2,
+                 int ppb,
+                 int sub_byte_offset,
+                 int no_mask,
+                 int mask_coef,
+                 int mask_col_index,
+                 u8 *data,
+                 u8 *buffer)
+{
+    int y, x;
+
+    for (y = y1; y < y2; y++) {
+        for (x = 0; x < width; x++) {
+            int c = (x - k) < 0 ? mask_col_index : data[y * width + x - k];
+            int mask_it = c == mask_col_index;
+            int offset = x % ppb;
+            int page = sub_byte_offset * k;
+            int scanline_len;
+            int x_byte_offset;
+            u8 *pixel_addr;
+            u8 *mask_addr;
+
+            if (!no_mask) {
+                scanline_len = width / ppb * mask_coef;
+                x_byte_offset = x / ppb * mask_coef;
+                /* Interlace sprite with masked data one byte interleaved */
+                pixel_addr = &buffer[y * scanline_len + (x_byte_offset + 1) + page];
+                mask_addr = &buffer[y * scanline_len + (x_byte_offset + 0) + page];
+            } else {
+                scanline_len = width / ppb;
+                x_byte_offset = x / ppb;
+                pixel_addr = &buffer[y * scanline_len + x_byte_offset + page];
+            }
+
+            if (mode == 2) {
+                int m = 1; /* mask color */
+
+                *pixel_addr |= MODE_2_PF(c, offset);
+                if (!no_mask && mask_it) {
+                    *mask_addr |= MODE_2_PF(m, offset);
+                }
+            } else if (mode == 1) {
+                int m = 3; /* mask color */
+
+                *pixel_addr |= MODE_1_PF(c, offset);
+                if (!no_mask && mask_it) {
+                    *mask_addr |= MODE_1_PF(m, offset);
+                }
+            } else if (mode == 0) {
+                int m = 15; /* mask color */
+
+                *pixel_addr |= MODE_0_PF(c, offset);
+                if (!no_mask && mask_it) {
+                    *mask_addr |= MODE_0_PF(m, offset);
+                }
+            }
+        }
+    }
+}
+
+void render(int width,
+            int height,
+            int mode,
+            int num_page,
+            int ppb,
+            int sub_byte_offset,
+            int no_mask,
+            int mask_coef,
+            int mask_col_index,
+            u8 *data,
+            u8 *buffer)
+{
+    int k;
+
+    /* For each offset image */
+    for (k = 0; k < num_page; k++) {
+        render_rows(width, mode, k, 0, height,
+                    ppb, sub_byte_offset, no_mask, mask_coef, mask_col_index,
+                    data, buffer);
+    }
+}
+
+struct render_job_s {
+    int width;
+    int height;
+    int mode;
+    int num_page;
+    int ppb;
+    int sub_byte_offset;
+    int no_mask;
+    int mask_coef;
+    int mask_col_index;
+    u8 *data;
+    u8 *buffer;
+    int bands;                     /* row bands per offset image */
+    int index;                     /* first band rendered by the job */
+    int jobs;                      /* stride between bands of the job */
+};
+
+void *render_job(void *arg)
+{
+    struct render_job_s *job = arg;
+    int i;
+
+    /* Every band is a disjoint set of rows of a single page */
+    for (i = job->index; i < job->num_page * job->bands; i += job->jobs) {
+        int k = i / job->bands;
+        int band = i % job->bands;
+
+        render_rows(job->width, job->mode, k,
+                    job->height * band / job->bands,
+                    job->height * (band + 1) / job->bands,
+                    job->ppb, job->sub_byte_offset, job->no_mask,
+                    job->mask_coef, job->mask_col_index, job->data, job->buffer);
+    }
+
+    return NULL;
+}
+
+/*
+  Same as render but the offset images are split into row bands which
+  are rendered by the given number of threads. Bands never share bytes
+  of the buffer when the width is a whole number of bytes, so the output
+  is the same as render. Other widths spill the last pixels of a row into
+  the first byte of the next row, and are rendered by render instead.
+*/
+void render_parallel(int jobs,
+                     int width,
+                     int height,
+                     int mode,
+                     int num_page,
+                     int ppb,
+                     int sub_byte_offset,
+                     int no_mask,
+                     int mask_coef,
+                     int mask_col_index,
+                     u8 *data,
+                     u8 *buffer)
+{
+    struct render_job_s *job;
+    pthread_t *threads;
+    int bands;
+    int i;
+
+    if (width % ppb != 0) {
+        render(width, height, mode, num_page, ppb, sub_byte_offset,
+               no_mask, mask_coef, mask_col_index, data, buffer);
+        return;
+    }
+
+    /* Enough bands for every thread, but no empty ones */
+    bands = (jobs + num_page - 1) / num_page;
+    bands = bands > height ? height : bands;
+    bands = bands < 1 ? 1 : bands;
+
+    job = malloc(jobs * sizeof(*job));
+    threads = malloc(jobs * sizeof(*threads));
+
+    for (i = 0; i < jobs; i++) {
+        job[i].width = width;
+        job[i].height = height;
+        job[i].mode = mode;
+        job[i].num_page = num_page;
+        job[i].ppb = ppb;
+        job[i].sub_byte_offset = sub_byte_offset;
+        job[i].no_mask = no_mask;
+        job[i].mask_coef = mask_coef;
+        job[i].mask_col_index = mask_col_index;
+        job[i].data = data;
+        job[i].buffer = buffer;
+        job[i].bands = bands;
+        job[i].index = i;
+        job[i].jobs = jobs;
+
+        if (pthread_create(&threads[i], NULL, render_job, &job[i]) != 0) {
+            fprintf(stderr, "Could not create thread\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(job);
+}
+
+/*
+  Writes the horizontally mirrored copy of every page after the pages,
+  by reversing the bytes of each row through the flip table. Mask and
+  pixel bytes stay interleaved in the same order.
+*/
+void mirror(int width,
+            int height,
+            int mode,
+            int num_page,
+            int ppb,
+            int sub_byte_offset,
+            int mask_coef,
+            u8 *buffer)
+{
+    u8 table[256];
+    int scanline_len;
+    int y, x, k, i;
+
+    make_flip_table(table, mode);
+
+    scanline_len = width / ppb * mask_coef;
+
+    for (k = 0; k < num_page; k++) {
+        u8 *page = &buffer[sub_byte_offset * k];
+        u8 *mirrored = &buffer[sub_byte_offset * (num_page + k)];
+
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width / ppb; x++) {
+                for (i = 0; i < mask_coef; i++) {
+                    mirrored[y * scanline_len + (width / ppb - 1 - x) * mask_coef + i] =
+                        table[page[y * scanline_len + x * mask_coef + i]];
+                }
+            }
+        }
+    }
+}
+
+/*
+  Finds the bounding box of the non transparent pixels of each page and
+  moves the pages together without the transparent rows and byte
+  columns around them. With mirror, the pages are followed by their
+  mirrored copies. mask_col_index is -1 if no ink is transparent, then
+  only the shift padding is trimmed. Returns the new buffer size.
+*/
+int trim(int width,
+         int height,
+         int num_page,
+         int mirror,
+         int ppb,
+         int sub_byte_offset,
+         int mask_coef,
+         int mask_col_index,
+         u8 *data,
+         u8 *buffer,
+         struct page_s *pages)
+{
+    int y, x, k;
+    int scanline_len;
+    int size;
+
+    scanline_len = width / ppb * mask_coef;
+    size = 0;
+
+    for (k = 0; k < num_page; k++) {
+        int x1 = width / ppb, y1 = height, x2 = -1, y2 = -1;
+
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                int c = (x - k) < 0 ? mask_col_index : data[y * width + x - k];
+
+                if (c == mask_col_index) {
+                    continue;
+                }
+
+                x1 = x / ppb < x1 ? x / ppb : x1;
+                x2 = x / ppb > x2 ? x / ppb : x2;
+                y1 = y < y1 ? y : y1;
+                y2 = y > y2 ? y : y2;
+            }
+        }
+
+        if (x2 < 0) {
+            /* Fully transparent page */
+            x1 = y1 = 0;
+            x2 = y2 = -1;
+        }
+
+        pages[k].x = x1;
+        pages[k].y = y1;
+        pages[k].width = x2 - x1 + 1;
+        pages[k].height = y2 - y1 + 1;
+
+        if (mirror) {
+            pages[num_page + k] = pages[k];
+            pages[num_page + k].x = x2 < 0 ? 0 : width / ppb - 1 - x2;
+        }
+    }
+
+    for (k = 0; k < num_page * (mirror ? 2 : 1); k++) {
+        u8 *page = &buffer[sub_byte_offset * k];
+
+        pages[k].offset = size;
+
+        /* Pages only move backwards, so it can be done in place */
+        for (y = pages[k].y; y < pages[k].y + pages[k].height; y++) {
+            memmove(&buffer[size],
+                    &page[y * scanline_len + pages[k].x * mask_coef],
+                    pages[k].width * mask_coef);
+            size += pages[k].width * mask_coef;
+        }
+    }
+
+    return size;
+}
+
+/*
+  Draws the ASIC sprites of the file back into a gif as the CPC Plus
+  would display them, magnified and with the 12 bit palette.
+*/
+void unpack_asic(char *unpname,
+                 char *filename,
+                 int cells_x,
+                 int cells_y,
+                 int magnify_x,
+                 int magnify_y,
+                 u16 *palette)
+{
+    GifFileType *output_gif;
+    ColorMapObject *color_map_object;
+    FILE *file;
+    u8 *cells;
+    u8 *line;
+    int size;
+    int width, height;
+    int error_code;
+    int x, y, i;
+
+    size = cells_x * cells_y * ASIC_SIZE * ASIC_SIZE;
+    cells = malloc(size);
+
+    file = fopen(filename, "rb");
+
+    if (file == NULL || fread(cells, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "Unable to read file: %s\n", filename);
+        exit(1);
+    }
+
+    fclose(file);
+
+    color_map_object = GifMakeMapObject(16, NULL);
+
+    for (i = 0; i < 16; i++) {
+        unsigned int rgb = i ? ga_convert_plus_color_to_rgb(palette[i]) : 0;
+
+        color_map_object->Colors[i].Red = rgb >> 16;
+        color_map_object->Colors[i].Green = (rgb >> 8) & 0xff;
+        color_map_object->Colors[i].Blue = rgb & 0xff;
+    }
+
+    width = cells_x * ASIC_SIZE * magnify_x;
+    height = cells_y * ASIC_SIZE * magnify_y;
+
+    output_gif = EGifOpenFileName(unpname, 0, &error_code);
+
+    if (output_gif == NULL ||
+        EGifPutScreenDesc(output_gif, width, height, 4, 0, color_map_object) == GIF_ERROR ||
+        EGifPutImageDesc(output_gif, 0, 0, width, height, 0, NULL) == GIF_ERROR) {
+        fprintf(stderr, "Could not write file: %s\n", unpname);
+        exit(1);
+    }
+
+    line = malloc(width);
+
+    for (y = 0; y < height; y++) {
+        int cy = y / magnify_y;
+
+        for (x = 0; x < width; x++) {
+            int cx = x / magnify_x;
+            int cell = cy / ASIC_SIZE * cells_x + cx / ASIC_SIZE;
+
+            /* Only the low nibble is used by the ASIC */
+            line[x] = cells[cell * ASIC_SIZE * ASIC_SIZE +
+                            cy % ASIC_SIZE * ASIC_SIZE + cx % ASIC_SIZE] & 15;
+        }
+
+        EGifPutLine(output_gif, line, width);
+    }
+
+    EGifCloseFile(output_gif, &error_code);
+    GifFreeMapObject(color_map_object);
+
+    free(line);
+    free(cells);
+
+    printf("File %s is created.\n", unpname);
+}
+
+/*
+  Slices the image into 16x16 CPC Plus hardware sprites, a byte with
+  the ink in the low nibble for each pixel, as in the ASIC page. Ink 0
+  is transparent, so the transparent ink is moved there first.
+*/
+void convert_asic(struct args_s *args, struct config_s *config, struct gif_s *gif)
+{
+    u16 palette[16];
+    u8 *buffer;
+    int cells_x, cells_y;
+    int size;
+    int x, y;
+
+    if (args->mask_col_index != 0) {
+        gif_move_to_zero(gif, args->mask_col_index);
+    }
+
+    cells_x = (gif->width + ASIC_SIZE - 1) / ASIC_SIZE;
+    cells_y = (gif->height + ASIC_SIZE - 1) / ASIC_SIZE;
+    size = cells_x * cells_y * ASIC_SIZE * ASIC_SIZE;
+
+    buffer = malloc(size);
+    memset(buffer, 0, size);
+
+    for (y = 0; y < gif->height; y++) {
+        for (x = 0; x < gif->width; x++) {
+            int c = gif->data[y * gif->width + x];
+            int cell = y / ASIC_SIZE * cells_x + x / ASIC_SIZE;
+
+            if (c > 15) {
+                fprintf(stderr, "Ink %d at %d, %d: ASIC sprites have 16 inks\n", c, x, y);
+                exit(1);
+            }
+
+            buffer[cell * ASIC_SIZE * ASIC_SIZE + y % ASIC_SIZE * ASIC_SIZE + x % ASIC_SIZE] = c;
+        }
+    }
+
+    write_output(config->filename, args->output, buffer, size);
+
+    write_plus_palette(config->palname, args->palette_fd, config->basename_filename,
+                       gif->colormap, gif->color_count, palette);
+
+    write_asic_table(config->sprname, config->basename_filename,
+                     cells_x, cells_y, args->magnify_x, args->magnify_y);
+
+    if (args->unpack) {
+        unpack_asic(config->unpname, config->filename,
+                    cells_x, cells_y, args->magnify_x, args->magnify_y, palette);
+    }
+
+    free(buffer);
+}
+
+/* Reads the gif and prepares its inks as the arguments ask */
+void load(struct args_s *args, struct gif_s *gif)
+{
+    gif_open(args->inputfile, gif);
+
+    if (args->resample >= 0) {
+        gif_resample(gif, args->mode, args->resample, args->jobs);
+    }
+
+    if (args->mask_col_index == -1) {
+        gif_transparent_to_zero(gif);
+        args->mask_col_index = 0;
+    }
+
+    /* The table only clears screen pixels, the pixel byte adds its bits */
+    if (args->mask_table && args->mask_col_index != 0) {
+        gif_move_to_zero(gif, args->mask_col_index);
+
+        /* The colour of ink 0 moves to an ink the gif may not have */
+        if (gif->color_count <= args->mask_col_index) {
+            gif->color_count = args->mask_col_index + 1;
+        }
+
+        args->mask_col_index = 0;
+    }
+}
+
+/*
+  Converts the gif into its outputs. The tables shared by every sprite
+  of the mode are written only if tables is 1.
+*/
+void convert(struct args_s *args, struct gif_s *gif, int tables)
+{
+    struct config_s config;
+
+    parse_config(&config, args, gif);
+
+    if (args->asic) {
+        convert_asic(args, &config, gif);
+        config_free(&config);
+        return;
+    }
+
+    if (args->jobs > 1) {
+        render_parallel(args->jobs,
+                        gif->width,
+                        gif->height,
+                        args->mode,
+                        config.num_page,
+                        config.ppb,
+                        config.sub_byte_offset,
+                        args->no_mask,
+                        config.mask_coef,
+                        args->mask_col_index,
+                        gif->data,
+                        config.buffer);
+    } else {
+        render(gif->width,
+               gif->height,
+               args->mode,
+               config.num_page,
+               config.ppb,
+               config.sub_byte_offset,
+               args->no_mask,
+               config.mask_coef,
+               args->mask_col_index,
+               gif->data,
+               config.buffer);
+    }
+
+    if (args->mirror) {
+        mirror(gif->width,
+               gif->height,
+               args->mode,
+               config.num_page,
+               config.ppb,
+               config.sub_byte_offset,
+               config.mask_coef,
+               config.buffer);
+    }
+
+    /* Before trimming, which packs the pages in place */
+    if (args->skip_list) {
+        write_skip_list(config.skpname,
+                        gif->width,
+                        gif->height,
+                        config.num_image,
+                        config.ppb,
+                        config.page_size,
+                        config.buffer);
+    }
+
+    if (args->trim) {
+        int trimmed_size;
+
+        /* The page table has a byte for each of x, y, width and height */
+        if (gif->height > 255 || gif->width / config.ppb > 255) {
+            fprintf(stderr, "--trim takes at most 255 rows of 255 bytes, the sprite has %d rows of %d bytes\n",
+                    gif->height, gif->width / config.ppb);
+            exit(1);
+        }
+
+        /* Without mask data the transparent ink is drawn as a colour */
+        trimmed_size = trim(gif->width,
+                            gif->height,
+                            config.num_page,
+                            args->mirror,
+                            config.ppb,
+                            config.sub_byte_offset,
+                            config.mask_coef,
+                            args->no_mask && !args->mask_table ? -1 : args->mask_col_index,
+                            gif->data,
+                            config.buffer,
+                            config.pages);
+
+        printf("trimmed: %d -> %d bytes\n", config.buffer_size, trimmed_size);
+
+        config.buffer_size = trimmed_size;
+
+        write_page_table(config.tblname, config.basename_filename, config.pages, config.num_image);
+    }
+
+    write_output(config.filename, args->output, config.buffer, config.buffer_size);
+
+    write_palette(config.palname, args->palette_fd, config.basename_filename, gif->colormap, gif->color_count);
+
+    if (args->shift_table && tables) {
+        write_shift_tables(config.shfname, args->mode);
+
+        /* Tables are shared by every sprite of the same mode */
+        printf("pre-shifted pages: %d bytes, unshifted + shift tables: %d + %d bytes\n",
+               config.page_size * config.ppb,
+               config.page_size,
+               (config.ppb - 1) * 2 * 256);
+    }
+
+    if (args->flip_table && tables) {
+        write_flip_table(config.flpname, args->mode);
+    }
+
+    if (args->collision) {
+        write_collision(config.colname,
+                        gif->width,
+                        gif->height,
+                        config.num_page,
+                        args->mirror,
+                        config.ppb,
+                        args->collision == 2,
+                        args->mask_col_index,
+                        gif->data);
+    }
+
+    if (args->mask_table && tables) {
+        write_mask_table(config.mskname, args->mode, args->mask_col_index);
+
+        printf("mask data saved: %d bytes, mask table: 256 bytes\n", config.buffer_size);
+    }
+
+    config_free(&config);
+}
+
+struct asset_s {
+    struct args_s args;            /* arguments with the asset's input file */
+    struct gif_s gif;
+    int tables;                    /* 1 if the asset writes the shared tables */
+    int used[256];                 /* number of pixels of each ink */
+    int inks[256];                 /* shared palette ink of each ink */
+};
+
+void *load_job(void *arg)
+{
+    struct asset_s *asset = arg;
+
+    load(&asset->args, &asset->gif);
+
+    return NULL;
+}
+
+void *convert_job(void *arg)
+{
+    struct asset_s *asset = arg;
+
+    convert(&asset->args, &asset->gif, asset->tables);
+
+    return NULL;
+}
+
+/* Runs the job for every asset, jobs assets at a time */
+void run_assets(struct asset_s *assets, int count, int jobs, void *(*job)(void *))
+{
+    pthread_t *threads;
+    int i, k;
+
+    threads = malloc(jobs * sizeof(*threads));
+
+    for (i = 0; i < count; i += jobs) {
+        int n = count - i < jobs ? count - i : jobs;
+
+        for (k = 0; k < n; k++) {
+            if (pthread_create(&threads[k], NULL, job, &assets[i + k]) != 0) {
+                fprintf(stderr, "Could not create thread\n");
+                exit(1);
+            }
+        }
+
+        for (k = 0; k < n; k++) {
+            pthread_join(threads[k], NULL);
+        }
+    }
+
+    free(threads);
+}
+
+/* Finds the colour of a hardware colour code, returns 0 if there is none */
+int hardware_color(int code, GifColorType *color)
+{
+    int i;
+
+    for (i = 0; i < 27; i++) {
+        unsigned int rgb = ga_convert_col_to_rgb(i);
+
+        color->Red = rgb >> 16;
+        color->Green = (rgb >> 8) & 0xff;
+        color->Blue = rgb & 0xff;
+
+        if (ga_find_gate_array_color_code(color->Red, color->Green, color->Blue) == code) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+  Reads the hardware colour of each ink from a .pal file of screen or
+  sprite, 0 for the inks the file leaves free.
+*/
+void read_fixed_palette(char *palname, int *fixed)
+{
+    FILE *file;
+    GifColorType color;
+    char line[512];
+    char *p;
+    int i;
+
+    file = fopen(palname, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open the palette: %s\n", palname);
+        exit(1);
+    }
+
+    if (fgets(line, sizeof(line), file) == NULL || strstr(line, " db ") == NULL) {
+        fprintf(stderr, "No db line in the palette: %s\n", palname);
+        exit(1);
+    }
+
+    fclose(file);
+
+    p = strstr(line, " db ") + 4;
+
+    for (i = 0; i < 16; i++) {
+        char *end;
+
+        fixed[i] = strtol(p, &end, 16);
+
+        if (end == p || (fixed[i] != 0 && !hardware_color(fixed[i], &color))) {
+            fprintf(stderr, "Ink %d of the palette is not a hardware colour: %s\n", i, palname);
+            exit(1);
+        }
+
+        for (p = end; *p == ',' || *p == ' '; p++)
+            ;
+    }
+}
+
+/*
+  Finds a palette of the inks of the mode with every colour the assets
+  use, colours being the same if they are the same hardware colour. The
+  inks given a hardware colour by fixed keep it, unless fixed is NULL.
+  The first asset keeps its inks where possible and the transparent ink
+  is kept, unless it is -1. Then remaps the images to the palette and
+  replaces their colour maps. Exits with the colours and their assets if
+  they do not fit.
+*/
+void solve_palette(struct asset_s *assets, int count, int mode, int transparent, int *fixed)
+{
+    GifColorType colors[32];       /* colours in order of use */
+    int codes[32];                 /* hardware colour of each colour */
+    int color_inks[32];            /* shared ink of each colour, -1 if none */
+    int taken[256];
+    GifColorType palette[256];
+    int color_count;
+    int ink_count;
+    int free_inks;
+    int needed;
+    int i, k, c, n;
+
+    ink_count = 1 << (8 / GET_PPB(mode));
+    color_count = 0;
+
+    /* Colours used by the images, inks holds the colour of each ink */
+    for (i = 0; i < count; i++) {
+        struct gif_s *gif = &assets[i].gif;
+
+        memset(assets[i].used, 0, sizeof(assets[i].used));
+
+        for (k = 0; k < gif->width * gif->height; k++) {
+            assets[i].used[gif->data[k]]++;
+        }
+
+        for (c = 0; c < 256; c++) {
+            int code;
+
+            if (!assets[i].used[c] || c == transparent) {
+                continue;
+            }
+
+            code = ga_find_gate_array_color_code(gif->colormap[c].Red,
+                                                 gif->colormap[c].Green,
+                                                 gif->colormap[c].Blue);
+
+            for (n = 0; n < color_count && codes[n] != code; n++)
+                ;
+
+            if (n == color_count) {
+                colors[n] = gif->colormap[c];
+                codes[n] = code;
+                color_inks[n] = -1;
+                color_count++;
+            }
+
+            assets[i].inks[c] = n;
+        }
+    }
+
+    memset(taken, 0, sizeof(taken));
+
+    if (transparent >= 0 && transparent < ink_count) {
+        taken[transparent] = 1;
+    }
+
+    /* The fixed inks keep their colour, used by the images or not */
+    for (c = 0; fixed && c < ink_count; c++) {
+        for (n = 0; fixed[c] && !taken[c] && n < color_count; n++) {
+            if (codes[n] == fixed[c] && color_inks[n] < 0) {
+                color_inks[n] = c;
+            }
+        }
+
+        taken[c] |= fixed[c] != 0;
+    }
+
+    free_inks = 0;
+    needed = 0;
+
+    for (c = 0; c < ink_count; c++) {
+        free_inks += !taken[c];
+    }
+
+    for (n = 0; n < color_count; n++) {
+        needed += color_inks[n] < 0;
+    }
+
+    if (needed > free_inks) {
+        fprintf(stderr, "Shared palette does not fit: %d colours for %d free inks of mode %d\n",
+                needed, free_inks, mode);
+
+        for (n = 0; n < color_count; n++) {
+            fprintf(stderr, "  colour 0x%.2x (%d, %d, %d):", codes[n],
+                    colors[n].Red, colors[n].Green, colors[n].Blue);
+
+            for (i = 0; i < count; i++) {
+                for (c = 0; c < 256; c++) {
+                    if (assets[i].used[c] && c != transparent && assets[i].inks[c] == n) {
+                        fprintf(stderr, " %s", assets[i].args.inputfile);
+                        break;
+                    }
+                }
+            }
+
+            fprintf(stderr, "\n");
+        }
+
+        exit(1);
+    }
+
+    /* The first asset keeps its inks, the other colours take free inks */
+    for (c = 0; c < ink_count; c++) {
+        if (assets[0].used[c] && !taken[c] && color_inks[assets[0].inks[c]] < 0) {
+            color_inks[assets[0].inks[c]] = c;
+            taken[c] = 1;
+        }
+    }
+
+    for (n = 0; n < color_count; n++) {
+        for (c = 0; color_inks[n] < 0; c++) {
+            if (!taken[c]) {
+                color_inks[n] = c;
+                taken[c] = 1;
+            }
+        }
+    }
+
+    memset(palette, 0, sizeof(palette));
+
+    for (n = 0; n < color_count; n++) {
+        palette[color_inks[n]] = colors[n];
+    }
+
+    if (transparent >= 0 && transparent < ink_count) {
+        palette[transparent] = assets[0].gif.colormap[transparent];
+    }
+
+    for (c = 0; fixed && c < ink_count; c++) {
+        if (fixed[c]) {
+            hardware_color(fixed[c], &palette[c]);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        struct gif_s *gif = &assets[i].gif;
+
+        for (c = 0; c < 256; c++) {
+            assets[i].inks[c] = c == transparent || !assets[i].used[c] ?
+                c : color_inks[assets[i].inks[c]];
+        }
+
+        for (k = 0; k < gif->width * gif->height; k++) {
+            gif->data[k] = assets[i].inks[gif->data[k]];
+        }
+
+        memcpy(gif->_info.colormap, palette, sizeof(palette));
+        gif->colormap = gif->_info.colormap;
+        gif->color_count = ink_count;
+    }
+
+    printf("shared palette: %d colours for %d assets\n", color_count, count);
+}
+
+/*
+  Converts every input against one palette, which keeps the inks of
+  --fixed-palette. The assets are read and converted jobs at a time,
+  each in its own thread.
+*/
+void convert_shared(struct args_s *args)
+{
+    struct asset_s *assets;
+    int fixed[16];
+    int i;
+
+    if (args->fixed_palette) {
+        read_fixed_palette(args->fixed_palette, fixed);
+    }
+
+    assets = malloc(args->input_count * sizeof(*assets));
+
+    for (i = 0; i < args->input_count; i++) {
+        assets[i].args = *args;
+        assets[i].args.inputfile = args->inputs[i];
+        assets[i].args.jobs = 1;
+        assets[i].tables = i == 0;
+    }
+
+    run_assets(assets, args->input_count, args->jobs, load_job);
+
+    /* Without mask data the transparent ink is drawn as a colour */
+    solve_palette(assets, args->input_count, args->mode,
+                  args->no_mask && !args->mask_table ? -1 : assets[0].args.mask_col_index,
+                  args->fixed_palette ? fixed : NULL);
+
+    run_assets(assets, args->input_count, args->jobs, convert_job);
+
+    for (i = 0; i < args->input_count; i++) {
+        gif_free(&assets[i].gif);
+    }
+
+    free(assets);
+}
+
+int main(int argc, char *argv[])
+{
+    struct args_s args;
+    struct gif_s gif;
+
+    parse_args(argc, argv, &args);
+
+    if (args.shared_palette) {
+        convert_shared(&args);
+        free(args.inputs);
+        return 0;
+    }
+
+    load(&args, &gif);
+
+    convert(&args, &gif, 1);
 
     gif_free(&gif);
+    free(args.inputs);
 
     return 0;
 }
@@ -0,0 +1,931 @@
+/**
+   Z80 interpreter for timing the CPC side routines.
+
+   Every instruction is executed with its Z80 T-states. On the CPC the
+   Gate Array stretches the memory accesses of the CPU to its 4 T-state
+   cycle, so the time of an instruction is counted in NOPs from the
+   tables below instead, e.g. push takes 4 NOPs for its 11 T-states.
+   Conditional instructions take extra NOPs when they branch or repeat.
+ */
+#include "z80.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PREFIX_IX 0xdd
+#define PREFIX_IY 0xfd
+
+/* Unprefixed opcodes, not taken for the conditional ones */
+static const u8 nops_main[256] = {
+    1, 3, 2, 2, 1, 1, 2, 1, 1, 3, 2, 2, 1, 1, 2, 1,  /* 00 */
+    3, 3, 2, 2, 1, 1, 2, 1, 3, 3, 2, 2, 1, 1, 2, 1,  /* 10 */
+    2, 3, 5, 2, 1, 1, 2, 1, 2, 3, 5, 2, 1, 1, 2, 1,  /* 20 */
+    2, 3, 4, 2, 3, 3, 3, 1, 2, 3, 4, 2, 1, 1, 2, 1,  /* 30 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* 40 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* 50 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* 60 */
+    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,  /* 70 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* 80 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* 90 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* a0 */
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  /* b0 */
+    2, 3, 3, 3, 3, 4, 2, 4, 2, 3, 3, 0, 3, 5, 2, 4,  /* c0 */
+    2, 3, 3, 3, 3, 4, 2, 4, 2, 1, 3, 3, 3, 0, 2, 4,  /* d0 */
+    2, 3, 3, 6, 3, 4, 2, 4, 2, 1, 3, 1, 3, 0, 2, 4,  /* e0 */
+    2, 3, 3, 1, 3, 4, 2, 4, 2, 2, 3, 1, 3, 0, 2, 4   /* f0 */
+};
+
+/* DD and FD opcodes, the prefix included */
+static const u8 nops_index[256] = {
+    2, 4, 3, 3, 2, 2, 3, 2, 2, 4, 3, 3, 2, 2, 3, 2,  /* 00 */
+    4, 4, 3, 3, 2, 2, 3, 2, 4, 4, 3, 3, 2, 2, 3, 2,  /* 10 */
+    3, 4, 6, 3, 2, 2, 3, 2, 3, 4, 6, 3, 2, 2, 3, 2,  /* 20 */
+    3, 4, 5, 3, 6, 6, 6, 2, 3, 4, 5, 3, 2, 2, 3, 2,  /* 30 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* 40 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* 50 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* 60 */
+    5, 5, 5, 5, 5, 5, 2, 5, 2, 2, 2, 2, 2, 2, 5, 2,  /* 70 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* 80 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* 90 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* a0 */
+    2, 2, 2, 2, 2, 2, 5, 2, 2, 2, 2, 2, 2, 2, 5, 2,  /* b0 */
+    3, 4, 4, 4, 4, 5, 3, 5, 3, 4, 4, 0, 4, 6, 3, 5,  /* c0 */
+    3, 4, 4, 4, 4, 5, 3, 5, 3, 2, 4, 4, 4, 0, 3, 5,  /* d0 */
+    3, 4, 4, 7, 4, 5, 3, 5, 3, 2, 4, 2, 4, 0, 3, 5,  /* e0 */
+    3, 4, 4, 2, 4, 5, 3, 5, 3, 3, 4, 2, 4, 0, 3, 5   /* f0 */
+};
+
+/* CB opcodes, the prefix included */
+static const u8 nops_cb[256] = {
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 00 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 10 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 20 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 30 */
+    2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,  /* 40 */
+    2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,  /* 50 */
+    2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,  /* 60 */
+    2, 2, 2, 2, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 3, 2,  /* 70 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 80 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* 90 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* a0 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* b0 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* c0 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* d0 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2,  /* e0 */
+    2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2   /* f0 */
+};
+
+/* ED opcodes, the prefix included, the last iteration of the repeats */
+static const u8 nops_ed[256] = {
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 00 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 10 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 20 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 30 */
+    4, 4, 4, 6, 2, 4, 2, 3, 4, 4, 4, 6, 2, 4, 2, 3,  /* 40 */
+    4, 4, 4, 6, 2, 4, 2, 3, 4, 4, 4, 6, 2, 4, 2, 3,  /* 50 */
+    4, 4, 4, 6, 2, 4, 2, 5, 4, 4, 4, 6, 2, 4, 2, 5,  /* 60 */
+    4, 4, 4, 6, 2, 4, 2, 2, 4, 4, 4, 6, 2, 4, 2, 2,  /* 70 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 80 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* 90 */
+    5, 4, 5, 5, 2, 2, 2, 2, 5, 4, 5, 5, 2, 2, 2, 2,  /* a0 */
+    5, 4, 5, 5, 2, 2, 2, 2, 5, 4, 5, 5, 2, 2, 2, 2,  /* b0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* c0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* d0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* e0 */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2   /* f0 */
+};
+
+static u8 rd(struct z80_s *z80, u16 addr)
+{
+    return z80->mem[addr];
+}
+
+static void wr(struct z80_s *z80, u16 addr, u8 value)
+{
+    z80->mem[addr] = value;
+}
+
+static u8 fetch8(struct z80_s *z80)
+{
+    return rd(z80, z80->pc++);
+}
+
+static u16 fetch16(struct z80_s *z80)
+{
+    u16 lo = fetch8(z80);
+
+    return lo | (fetch8(z80) << 8);
+}
+
+static u16 rd16(struct z80_s *z80, u16 addr)
+{
+    return rd(z80, addr) | (rd(z80, addr + 1) << 8);
+}
+
+static void wr16(struct z80_s *z80, u16 addr, u16 value)
+{
+    wr(z80, addr, value & 0xff);
+    wr(z80, addr + 1, value >> 8);
+}
+
+static void push(struct z80_s *z80, u16 value)
+{
+    z80->sp -= 2;
+    wr16(z80, z80->sp, value);
+}
+
+static u16 pop(struct z80_s *z80)
+{
+    u16 value = rd16(z80, z80->sp);
+
+    z80->sp += 2;
+
+    return value;
+}
+
+static int parity(u8 v)
+{
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+
+    return (v & 1) ? 0 : Z80_FLAG_PV;
+}
+
+static u8 flags_sz(u8 v)
+{
+    return (v & Z80_FLAG_S) | (v == 0 ? Z80_FLAG_Z : 0);
+}
+
+/* HL, IX or IY as selected by the prefix */
+static u16 get_hl(struct z80_s *z80, int prefix)
+{
+    return prefix == PREFIX_IX ? z80->ix :
+           prefix == PREFIX_IY ? z80->iy :
+           (z80->h << 8) | z80->l;
+}
+
+static void set_hl(struct z80_s *z80, int prefix, u16 value)
+{
+    if (prefix == PREFIX_IX) {
+        z80->ix = value;
+    } else if (prefix == PREFIX_IY) {
+        z80->iy = value;
+    } else {
+        z80->h = value >> 8;
+        z80->l = value & 0xff;
+    }
+}
+
+/* 8 bit register by opcode index, H and L are IXH/IXL with a prefix */
+static u8 get_r(struct z80_s *z80, int index, int prefix)
+{
+    switch (index) {
+    case 0: return z80->b;
+    case 1: return z80->c;
+    case 2: return z80->d;
+    case 3: return z80->e;
+    case 4: return get_hl(z80, prefix) >> 8;
+    case 5: return get_hl(z80, prefix) & 0xff;
+    case 7: return z80->a;
+    }
+
+    return 0;
+}
+
+static void set_r(struct z80_s *z80, int index, int prefix, u8 value)
+{
+    switch (index) {
+    case 0: z80->b = value; break;
+    case 1: z80->c = value; break;
+    case 2: z80->d = value; break;
+    case 3: z80->e = value; break;
+    case 4: set_hl(z80, prefix, (get_hl(z80, prefix) & 0xff) | (value << 8)); break;
+    case 5: set_hl(z80, prefix, (get_hl(z80, prefix) & 0xff00) | value); break;
+    case 7: z80->a = value; break;
+    }
+}
+
+/* BC, DE, HL/IX/IY, SP by opcode index */
+static u16 get_rp(struct z80_s *z80, int index, int prefix)
+{
+    switch (index) {
+    case 0: return (z80->b << 8) | z80->c;
+    case 1: return (z80->d << 8) | z80->e;
+    case 2: return get_hl(z80, prefix);
+    }
+
+    return z80->sp;
+}
+
+static void set_rp(struct z80_s *z80, int index, int prefix, u16 value)
+{
+    switch (index) {
+    case 0: z80->b = value >> 8; z80->c = value & 0xff; break;
+    case 1: z80->d = value >> 8; z80->e = value & 0xff; break;
+    case 2: set_hl(z80, prefix, value); break;
+    case 3: z80->sp = value; break;
+    }
+}
+
+static int condition(struct z80_s *z80, int index)
+{
+    switch (index) {
+    case 0: return !(z80->f & Z80_FLAG_Z);
+    case 1: return z80->f & Z80_FLAG_Z;
+    case 2: return !(z80->f & Z80_FLAG_C);
+    case 3: return z80->f & Z80_FLAG_C;
+    case 4: return !(z80->f & Z80_FLAG_PV);
+    case 5: return z80->f & Z80_FLAG_PV;
+    case 6: return !(z80->f & Z80_FLAG_S);
+    }
+
+    return z80->f & Z80_FLAG_S;
+}
+
+/* ADD, ADC, SUB, SBC, AND, XOR, OR, CP of A with the value */
+static void alu(struct z80_s *z80, int op, u8 v)
+{
+    int a = z80->a;
+    int carry = z80->f & Z80_FLAG_C;
+    int r;
+
+    switch (op) {
+    case 0:
+    case 1:
+        r = a + v + (op == 1 ? carry : 0);
+        z80->f = flags_sz(r & 0xff) | ((a ^ v ^ r) & Z80_FLAG_H)
+            | (((a ^ ~v) & (a ^ r) & 0x80) ? Z80_FLAG_PV : 0)
+            | (r > 0xff ? Z80_FLAG_C : 0);
+        z80->a = r;
+        break;
+    case 2:
+    case 3:
+    case 7:
+        r = a - v - (op == 3 ? carry : 0);
+        z80->f = flags_sz(r & 0xff) | ((a ^ v ^ r) & Z80_FLAG_H)
+            | (((a ^ v) & (a ^ r) & 0x80) ? Z80_FLAG_PV : 0)
+            | ((r & 0x100) ? Z80_FLAG_C : 0) | Z80_FLAG_N;
+        if (op != 7) {
+            z80->a = r;
+        }
+        break;
+    case 4:
+        z80->a &= v;
+        z80->f = flags_sz(z80->a) | parity(z80->a) | Z80_FLAG_H;
+        break;
+    case 5:
+        z80->a ^= v;
+        z80->f = flags_sz(z80->a) | parity(z80->a);
+        break;
+    case 6:
+        z80->a |= v;
+        z80->f = flags_sz(z80->a) | parity(z80->a);
+        break;
+    }
+}
+
+static u8 inc8(struct z80_s *z80, u8 v)
+{
+    u8 r = v + 1;
+
+    z80->f = (z80->f & Z80_FLAG_C) | flags_sz(r)
+        | ((v & 0xf) == 0xf ? Z80_FLAG_H : 0)
+        | (v == 0x7f ? Z80_FLAG_PV : 0);
+
+    return r;
+}
+
+static u8 dec8(struct z80_s *z80, u8 v)
+{
+    u8 r = v - 1;
+
+    z80->f = (z80->f & Z80_FLAG_C) | flags_sz(r) | Z80_FLAG_N
+        | ((v & 0xf) == 0 ? Z80_FLAG_H : 0)
+        | (v == 0x80 ? Z80_FLAG_PV : 0);
+
+    return r;
+}
+
+static u16 add16(struct z80_s *z80, u16 a, u16 v)
+{
+    unsigned long r = (unsigned long) a + v;
+
+    z80->f = (z80->f & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_PV))
+        | (((a ^ v ^ r) >> 8) & Z80_FLAG_H)
+        | (r > 0xffff ? Z80_FLAG_C : 0);
+
+    return r;
+}
+
+/* ADC HL or SBC HL */
+static u16 adc16(struct z80_s *z80, u16 a, u16 v, int subtract)
+{
+    long carry = z80->f & Z80_FLAG_C;
+    long r = subtract ? (long) a - v - carry : (long) a + v + carry;
+    u16 r16 = r & 0xffff;
+    int overflow = subtract
+        ? ((a ^ v) & (a ^ r16) & 0x8000) != 0
+        : ((a ^ ~v) & (a ^ r16) & 0x8000) != 0;
+
+    z80->f = ((r16 >> 8) & Z80_FLAG_S) | (r16 == 0 ? Z80_FLAG_Z : 0)
+        | (((a ^ v ^ r) >> 8) & Z80_FLAG_H)
+        | (overflow ? Z80_FLAG_PV : 0)
+        | ((r & 0x10000) ? Z80_FLAG_C : 0)
+        | (subtract ? Z80_FLAG_N : 0);
+
+    return r16;
+}
+
+/* RLC, RRC, RL, RR, SLA, SRA, SLL, SRL */
+static u8 rot(struct z80_s *z80, int op, u8 v)
+{
+    int carry = z80->f & Z80_FLAG_C;
+    int out;
+    u8 r;
+
+    switch (op) {
+    case 0: out = v >> 7; r = (v << 1) | out; break;
+    case 1: out = v & 1; r = (v >> 1) | (out << 7); break;
+    case 2: out = v >> 7; r = (v << 1) | carry; break;
+    case 3: out = v & 1; r = (v >> 1) | (carry << 7); break;
+    case 4: out = v >> 7; r = v << 1; break;
+    case 5: out = v & 1; r = (v >> 1) | (v & 0x80); break;
+    case 6: out = v >> 7; r = (v << 1) | 1; break;
+    default: out = v & 1; r = v >> 1; break;
+    }
+
+    z80->f = flags_sz(r) | parity(r) | (out ? Z80_FLAG_C : 0);
+
+    return r;
+}
+
+static void daa(struct z80_s *z80)
+{
+    int a = z80->a;
+    int correction = 0;
+    int carry = z80->f & Z80_FLAG_C;
+
+    if ((z80->f & Z80_FLAG_H) || (a & 0xf) > 9) {
+        correction |= 0x06;
+    }
+
+    if (carry || a > 0x99) {
+        correction |= 0x60;
+        carry = Z80_FLAG_C;
+    }
+
+    if (z80->f & Z80_FLAG_N) {
+        z80->a = a - correction;
+        z80->f = (z80->f & Z80_FLAG_N) | ((a ^ z80->a) & Z80_FLAG_H);
+    } else {
+        z80->a = a + correction;
+        z80->f = (a ^ z80->a) & Z80_FLAG_H;
+    }
+
+    z80->f |= flags_sz(z80->a) | parity(z80->a) | carry;
+}
+
+static int step_cb(struct z80_s *z80, int prefix)
+{
+    int op;
+    int x, y, z;
+    u16 addr;
+    u8 v;
+
+    addr = 0;
+
+    if (prefix) {
+        /* DD CB d op: displacement comes before the opcode */
+        addr = get_hl(z80, prefix) + (signed char) fetch8(z80);
+        op = fetch8(z80);
+    } else {
+        op = fetch8(z80);
+        addr = get_hl(z80, 0);
+    }
+
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    z = op & 7;
+
+    /* DD CB d op takes 6 NOPs for BIT and 7 for the others */
+    z80->nops += prefix ? (x == 1 ? 6 : 7) : nops_cb[op];
+
+    v = (prefix || z == 6) ? rd(z80, addr) : get_r(z80, z, 0);
+
+    if (x == 1) {
+        z80->f = (z80->f & Z80_FLAG_C) | Z80_FLAG_H
+            | ((v & (1 << y)) ? (y == 7 ? Z80_FLAG_S : 0) : Z80_FLAG_Z | Z80_FLAG_PV);
+
+        /* The prefix itself is counted by the caller */
+        return prefix ? 16 : z == 6 ? 12 : 8;
+    }
+
+    v = x == 0 ? rot(z80, y, v) :
+        x == 2 ? v & ~(1 << y) :
+        v | (1 << y);
+
+    if (prefix || z == 6) {
+        wr(z80, addr, v);
+    }
+
+    if (z != 6) {
+        /* With a prefix the result is copied into the register as well */
+        set_r(z80, z, 0, v);
+    }
+
+    return prefix ? 19 : z == 6 ? 15 : 8;
+}
+
+static int step_ed(struct z80_s *z80)
+{
+    int op;
+    int x, y, z, p, q;
+    u16 hl, de, bc;
+
+    op = fetch8(z80);
+
+    z80->nops += nops_ed[op];
+
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    z = op & 7;
+    p = y >> 1;
+    q = y & 1;
+
+    if (x == 1) {
+        switch (z) {
+        case 0:
+            /* IN r,(C): no devices, the bus reads 0xff */
+            if (y != 6) {
+                set_r(z80, y, 0, 0xff);
+            }
+            z80->f = (z80->f & Z80_FLAG_C) | flags_sz(0xff) | parity(0xff);
+            return 12;
+        case 1:
+            /* OUT (C),r: no devices */
+            return 12;
+        case 2:
+            set_hl(z80, 0, adc16(z80, get_hl(z80, 0), get_rp(z80, p, 0), !q));
+            return 15;
+        case 3:
+            if (q) {
+                set_rp(z80, p, 0, rd16(z80, fetch16(z80)));
+            } else {
+                wr16(z80, fetch16(z80), get_rp(z80, p, 0));
+            }
+            return 20;
+        case 4:
+            {
+                u8 a = z80->a;
+
+                z80->a = 0;
+                alu(z80, 2, a);
+            }
+            return 8;
+        case 5:
+            z80->pc = pop(z80);
+            return 14;
+        case 6:
+            return 8;
+        case 7:
+            switch (y) {
+            case 0: z80->i = z80->a; return 9;
+            case 1: z80->r = z80->a; return 9;
+            case 2:
+            case 3:
+                z80->a = y == 2 ? z80->i : z80->r;
+                z80->f = (z80->f & Z80_FLAG_C) | flags_sz(z80->a)
+                    | (z80->iff ? Z80_FLAG_PV : 0);
+                return 9;
+            case 4:
+            case 5:
+                {
+                    u16 addr = get_hl(z80, 0);
+                    u8 m = rd(z80, addr);
+
+                    if (y == 4) {
+                        wr(z80, addr, (m >> 4) | (z80->a << 4));
+                        z80->a = (z80->a & 0xf0) | (m & 0x0f);
+                    } else {
+                        wr(z80, addr, (m << 4) | (z80->a & 0x0f));
+                        z80->a = (z80->a & 0xf0) | (m >> 4);
+                    }
+
+                    z80->f = (z80->f & Z80_FLAG_C) | flags_sz(z80->a) | parity(z80->a);
+                }
+                return 18;
+            }
+            return 8;
+        }
+    }
+
+    if (x == 2 && y >= 4 && z <= 3) {
+        int dir = (y & 1) ? -1 : 1;
+        int repeat = y >= 6;
+
+        hl = get_hl(z80, 0);
+        de = get_rp(z80, 1, 0);
+        bc = get_rp(z80, 0, 0);
+
+        switch (z) {
+        case 0:
+            /* LDI, LDD, LDIR, LDDR */
+            wr(z80, de, rd(z80, hl));
+            set_hl(z80, 0, hl + dir);
+            set_rp(z80, 1, 0, de + dir);
+            set_rp(z80, 0, 0, --bc);
+            z80->f = (z80->f & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_C))
+                | (bc ? Z80_FLAG_PV : 0);
+            repeat = repeat && bc;
+            break;
+        case 1:
+            /* CPI, CPD, CPIR, CPDR */
+            {
+                u8 carry = z80->f & Z80_FLAG_C;
+                u8 m = rd(z80, hl);
+
+                alu(z80, 7, m);
+                set_hl(z80, 0, hl + dir);
+                set_rp(z80, 0, 0, --bc);
+                z80->f = (z80->f & ~(Z80_FLAG_PV | Z80_FLAG_C))
+                    | (bc ? Z80_FLAG_PV : 0) | carry;
+                repeat = repeat && bc && z80->a != m;
+            }
+            break;
+        default:
+            /* INI, OUTI and friends: no devices, only the counters move */
+            if (z == 2) {
+                wr(z80, hl, 0xff);
+            }
+            set_hl(z80, 0, hl + dir);
+            z80->b--;
+            z80->f = flags_sz(z80->b) | Z80_FLAG_N;
+            repeat = repeat && z80->b;
+            break;
+        }
+
+        if (repeat) {
+            z80->pc -= 2;
+            z80->nops += z == 1 ? 2 : 1;
+            return 21;
+        }
+
+        return 16;
+    }
+
+    /* Invalid ED opcodes are NOPs */
+    return 8;
+}
+
+int z80_step(struct z80_s *z80)
+{
+    int op;
+    int x, y, z, p, q;
+    int prefix;
+    int prefixes;
+    int t;
+    u16 addr;
+
+    prefix = 0;
+    prefixes = 0;
+    t = 0;
+
+    z80->r = (z80->r & 0x80) | ((z80->r + 1) & 0x7f);
+
+    op = fetch8(z80);
+
+    while (op == PREFIX_IX || op == PREFIX_IY) {
+        prefix = op;
+        prefixes++;
+        t += 4;
+        op = fetch8(z80);
+    }
+
+    if (op == 0xed) {
+        /* ED ignores any index prefix, each takes a NOP */
+        z80->nops += prefixes;
+        return t + step_ed(z80);
+    }
+
+    /* The tables count the last prefix, the others take a NOP each */
+    if (prefixes > 1) {
+        z80->nops += prefixes - 1;
+    }
+
+    if (op == 0xcb) {
+        return t + step_cb(z80, prefix);
+    }
+
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    z = op & 7;
+    p = y >> 1;
+    q = y & 1;
+
+    z80->nops += prefix ? nops_index[op] : nops_main[op];
+
+    /* Memory operand for (HL), (IX+d) or (IY+d) */
+    addr = get_hl(z80, prefix);
+
+    switch (x) {
+    case 0:
+        switch (z) {
+        case 0:
+            switch (y) {
+            case 0:
+                return t + 4;
+            case 1:
+                {
+                    u8 a = z80->a, f = z80->f;
+
+                    z80->a = z80->a2;
+                    z80->f = z80->f2;
+                    z80->a2 = a;
+                    z80->f2 = f;
+                }
+                return t + 4;
+            case 2:
+                {
+                    signed char d = fetch8(z80);
+
+                    if (--z80->b) {
+                        z80->pc += d;
+                        z80->nops++;
+                        return t + 13;
+                    }
+                }
+                return t + 8;
+            case 3:
+                {
+                    signed char d = fetch8(z80);
+
+                    z80->pc += d;
+                }
+                return t + 12;
+            default:
+                {
+                    signed char d = fetch8(z80);
+
+                    if (condition(z80, y - 4)) {
+                        z80->pc += d;
+                        z80->nops++;
+                        return t + 12;
+                    }
+                }
+                return t + 7;
+            }
+        case 1:
+            if (q) {
+                set_hl(z80, prefix, add16(z80, get_hl(z80, prefix), get_rp(z80, p, prefix)));
+                return t + 11;
+            }
+            set_rp(z80, p, prefix, fetch16(z80));
+            return t + 10;
+        case 2:
+            switch (y) {
+            case 0: wr(z80, get_rp(z80, 0, 0), z80->a); return t + 7;
+            case 1: z80->a = rd(z80, get_rp(z80, 0, 0)); return t + 7;
+            case 2: wr(z80, get_rp(z80, 1, 0), z80->a); return t + 7;
+            case 3: z80->a = rd(z80, get_rp(z80, 1, 0)); return t + 7;
+            case 4: wr16(z80, fetch16(z80), get_hl(z80, prefix)); return t + 16;
+            case 5: set_hl(z80, prefix, rd16(z80, fetch16(z80))); return t + 16;
+            case 6: wr(z80, fetch16(z80), z80->a); return t + 13;
+            case 7: z80->a = rd(z80, fetch16(z80)); return t + 13;
+            }
+            break;
+        case 3:
+            set_rp(z80, p, prefix, get_rp(z80, p, prefix) + (q ? -1 : 1));
+            return t + 6;
+        case 4:
+        case 5:
+            if (y == 6) {
+                if (prefix) {
+                    addr += (signed char) fetch8(z80);
+                    t += 8;
+                }
+                wr(z80, addr, z == 4 ? inc8(z80, rd(z80, addr)) : dec8(z80, rd(z80, addr)));
+                return t + 11;
+            }
+            set_r(z80, y, prefix, z == 4 ? inc8(z80, get_r(z80, y, prefix))
+                                         : dec8(z80, get_r(z80, y, prefix)));
+            return t + 4;
+        case 6:
+            if (y == 6) {
+                if (prefix) {
+                    addr += (signed char) fetch8(z80);
+                    t += 5;
+                }
+                wr(z80, addr, fetch8(z80));
+                return t + 10;
+            }
+            set_r(z80, y, prefix, fetch8(z80));
+            return t + 7;
+        case 7:
+            {
+                u8 a = z80->a;
+                u8 keep = z80->f & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_PV);
+
+                switch (y) {
+                case 0: z80->a = (a << 1) | (a >> 7); z80->f = keep | (a >> 7); break;
+                case 1: z80->a = (a >> 1) | (a << 7); z80->f = keep | (a & 1); break;
+                case 2: z80->a = (a << 1) | (z80->f & Z80_FLAG_C); z80->f = keep | (a >> 7); break;
+                case 3: z80->a = (a >> 1) | ((z80->f & Z80_FLAG_C) << 7); z80->f = keep | (a & 1); break;
+                case 4: daa(z80); break;
+                case 5: z80->a = ~a; z80->f |= Z80_FLAG_H | Z80_FLAG_N; break;
+                case 6: z80->f = (z80->f & ~(Z80_FLAG_H | Z80_FLAG_N)) | Z80_FLAG_C; break;
+                case 7:
+                    z80->f = ((z80->f & ~(Z80_FLAG_H | Z80_FLAG_N)) ^ Z80_FLAG_C)
+                        | ((z80->f & Z80_FLAG_C) ? Z80_FLAG_H : 0);
+                    break;
+                }
+            }
+            return t + 4;
+        }
+        break;
+    case 1:
+        if (op == 0x76) {
+            z80->halted = 1;
+            z80->pc--;
+            return t + 4;
+        }
+        if (y == 6 || z == 6) {
+            if (prefix) {
+                addr += (signed char) fetch8(z80);
+                t += 8;
+            }
+            if (y == 6) {
+                wr(z80, addr, get_r(z80, z, 0));
+            } else {
+                set_r(z80, y, 0, rd(z80, addr));
+            }
+            return t + 7;
+        }
+        set_r(z80, y, prefix, get_r(z80, z, prefix));
+        return t + 4;
+    case 2:
+        if (z == 6) {
+            if (prefix) {
+                addr += (signed char) fetch8(z80);
+                t += 8;
+            }
+            alu(z80, y, rd(z80, addr));
+            return t + 7;
+        }
+        alu(z80, y, get_r(z80, z, prefix));
+        return t + 4;
+    case 3:
+        switch (z) {
+        case 0:
+            if (condition(z80, y)) {
+                z80->pc = pop(z80);
+                z80->nops += 2;
+                return t + 11;
+            }
+            return t + 5;
+        case 1:
+            if (!q) {
+                u16 value = pop(z80);
+
+                if (p == 3) {
+                    z80->a = value >> 8;
+                    z80->f = value & 0xff;
+                } else {
+                    set_rp(z80, p, prefix, value);
+                }
+                return t + 10;
+            }
+            switch (p) {
+            case 0:
+                z80->pc = pop(z80);
+                return t + 10;
+            case 1:
+                {
+                    u8 v;
+
+                    v = z80->b; z80->b = z80->b2; z80->b2 = v;
+                    v = z80->c; z80->c = z80->c2; z80->c2 = v;
+                    v = z80->d; z80->d = z80->d2; z80->d2 = v;
+                    v = z80->e; z80->e = z80->e2; z80->e2 = v;
+                    v = z80->h; z80->h = z80->h2; z80->h2 = v;
+                    v = z80->l; z80->l = z80->l2; z80->l2 = v;
+                }
+                return t + 4;
+            case 2:
+                z80->pc = get_hl(z80, prefix);
+                return t + 4;
+            case 3:
+                z80->sp = get_hl(z80, prefix);
+                return t + 6;
+            }
+            break;
+        case 2:
+            {
+                u16 nn = fetch16(z80);
+
+                if (condition(z80, y)) {
+                    z80->pc = nn;
+                }
+            }
+            return t + 10;
+        case 3:
+            switch (y) {
+            case 0:
+                z80->pc = fetch16(z80);
+                return t + 10;
+            case 2:
+                /* OUT (n),A: no devices */
+                fetch8(z80);
+                return t + 11;
+            case 3:
+                fetch8(z80);
+                z80->a = 0xff;
+                return t + 11;
+            case 4:
+                {
+                    u16 value = rd16(z80, z80->sp);
+
+                    wr16(z80, z80->sp, get_hl(z80, prefix));
+                    set_hl(z80, prefix, value);
+                }
+                return t + 19;
+            case 5:
+                {
+                    u8 v;
+
+                    v = z80->d; z80->d = z80->h; z80->h = v;
+                    v = z80->e; z80->e = z80->l; z80->l = v;
+                }
+                return t + 4;
+            case 6:
+                z80->iff = 0;
+                return t + 4;
+            case 7:
+                z80->iff = 1;
+                return t + 4;
+            }
+            break;
+        case 4:
+            {
+                u16 nn = fetch16(z80);
+
+                if (condition(z80, y)) {
+                    push(z80, z80->pc);
+                    z80->pc = nn;
+                    z80->nops += 2;
+                    return t + 17;
+                }
+            }
+            return t + 10;
+        case 5:
+            if (!q) {
+                push(z80, p == 3 ? (z80->a << 8) | z80->f : get_rp(z80, p, prefix));
+                return t + 11;
+            }
+            if (p == 0) {
+                u16 nn = fetch16(z80);
+
+                push(z80, z80->pc);
+                z80->pc = nn;
+                return t + 17;
+            }
+            break;
+        case 6:
+            alu(z80, y, fetch8(z80));
+            return t + 7;
+        case 7:
+            push(z80, z80->pc);
+            z80->pc = y * 8;
+            return t + 11;
+        }
+        break;
+    }
+
+    return -1;
+}
+
+void z80_reset(struct z80_s *z80, u8 *mem)
+{
+    memset(z80, 0, sizeof(*z80));
+
+    z80->mem = mem;
+    z80->a = z80->f = 0xff;
+    z80->sp = 0xffff;
+}
+
+int z80_run(struct z80_s *z80, unsigned long max_nops)
+{
+    while (!z80->halted && z80->nops < max_nops) {
+        u16 pc = z80->pc;
+        int t = z80_step(z80);
+
+        if (t < 0) {
+            fprintf(stderr, "Unsupported opcode 0x%.2x at 0x%.4x\n", z80->mem[pc], pc);
+            return -1;
+        }
+
+        z80->tstates += t;
+    }
+
+    return z80->halted ? 0 : -1;
+}
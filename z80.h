@@ -0,0 +1,45 @@
+#ifndef __Z80_H_
+#define __Z80_H_
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+
+/* Flag bits of the F register */
+#define Z80_FLAG_C  0x01
+#define Z80_FLAG_N  0x02
+#define Z80_FLAG_PV 0x04
+#define Z80_FLAG_H  0x10
+#define Z80_FLAG_Z  0x40
+#define Z80_FLAG_S  0x80
+
+struct z80_s {
+    u8 a, f, b, c, d, e, h, l;
+    u8 a2, f2, b2, c2, d2, e2, h2, l2; /* alternate register set */
+    u16 ix;
+    u16 iy;
+    u16 sp;
+    u16 pc;
+    u8 i;
+    u8 r;
+    int iff;                       /* interrupts enabled */
+    int halted;                    /* 1 after HALT is executed */
+    u8 *mem;                       /* 64K of memory */
+    unsigned long tstates;         /* Z80 T-states executed */
+    unsigned long nops;            /* CPC NOPs executed */
+};
+
+void z80_reset(struct z80_s *z80, u8 *mem);
+
+/*
+  Executes a single instruction, adds its CPC NOPs to nops and returns
+  its T-states, or -1 if the opcode is not supported.
+*/
+int z80_step(struct z80_s *z80);
+
+/*
+  Executes instructions until HALT or until max_nops have elapsed.
+  Returns 0 on HALT, -1 otherwise.
+*/
+int z80_run(struct z80_s *z80, unsigned long max_nops);
+
+#endif